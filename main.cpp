@@ -1,13 +1,29 @@
-#include <fstream>
 #include <vector>
 #include "glm/glm.hpp"
 #include <array>
-#include <SDL.h>
-#include <sstream>
+#include <SDL.h> // SDL2main provides the entry point on Windows
 #include <filesystem>
 #include <iostream>
+#include <span>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <map>
+#include <random>
+#include <thread>
+#include <charconv>
+#include <limits>
+#include <string_view>
 #pragma once
 #include "shaders.hpp"
+#include "objLoader.hpp"
+#include "meshCache.hpp"
+#include "vertexCache.hpp"
+#include "vertexStreams.hpp"
+#include "rasterizer.hpp"
+#include "threadPool.hpp"
+#include "renderTarget.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 
 std::string getCurrentPath() {
@@ -19,36 +35,29 @@ std::string getParentDirectory(const std::string& path) {
     return filePath.parent_path().string();
 }
 
-SDL_Window* window = nullptr;
-SDL_Renderer* renderer = nullptr;
 const int SCREEN_WIDTH = 720;
 const int SCREEN_HEIGHT = 480;
 
+// Todo el sombreado escribe aquí; el render target solo recibe una copia por frame
+Framebuffer framebuffer;
+
 Color currentColor = {255, 255, 255, 255}; // Initially set to white
 Color clearColor = {0, 0, 0, 255}; // Initially set to black
-std::vector<glm::vec3> vertices;
-std::vector<Face> faces;
-
-void init() {
-    SDL_Init(SDL_INIT_VIDEO);
-    window = SDL_CreateWindow("Software Renderer", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-}
+Mesh mesh;
 
 void setColor(const Color& color) {
     currentColor = color;
 }
 // Function to clear the framebuffer with the clearColor
 void clear() {
-    SDL_SetRenderDrawColor(renderer, clearColor.r, clearColor.g, clearColor.b, clearColor.a);
-    SDL_RenderClear(renderer);
+    framebuffer.clear(clearColor);
 }
 // Function to set a specific pixel in the framebuffer to the currentColor
 void point(int x, int y) {
-    SDL_SetRenderDrawColor(renderer, currentColor.r, currentColor.g, currentColor.b, currentColor.a);
-    SDL_RenderDrawPoint(renderer, x, y);
+    if (x >= 0 && x < framebuffer.width && y >= 0 && y < framebuffer.height) {
+        framebuffer.at(x, y) = currentColor;
+    }
 }
-
 void line(glm::vec3 start, glm::vec3 end) {
     int x1 = round(start.x), y1 = round(start.y);
     int x2 = round(end.x), y2 = round(end.y);
@@ -86,36 +95,38 @@ int max3(int a, int b, int c) {
     return maxAB > c ? maxAB : c;
 }
 
-std::vector<Fragment> triangle(const glm::vec3& A, const glm::vec3& B, const glm::vec3& C) {
-    std::vector<Fragment> fragments;
-
-    // Calculate the minimum and maximum y-coordinates of the triangle
-    int minY = min3(static_cast<int>(A.y), static_cast<int>(B.y), static_cast<int>(C.y));
-    int maxY = max3(static_cast<int>(A.y), static_cast<int>(B.y), static_cast<int>(C.y));
-
-    // Calculate the minimum and maximum x-coordinates of the triangle
-    int minX = min3(static_cast<int>(A.x), static_cast<int>(B.x), static_cast<int>(C.x));
-    int maxX = max3(static_cast<int>(A.x), static_cast<int>(B.x), static_cast<int>(C.x));
-
-    // Rasterization algorithm (scanline)
-    for (int y = minY; y <= maxY; y++) {
-        for (int x = minX; x <= maxX; x++) {
-            glm::vec3 P(x + 0.5f, y + 0.5f, 0.0f);
-
-            // Calculate barycentric coordinates
-            float alpha = ((B.y - C.y) * (P.x - C.x) + (C.x - B.x) * (P.y - C.y)) /
-                          ((B.y - C.y) * (A.x - C.x) + (C.x - B.x) * (A.y - C.y));
-            float beta = ((C.y - A.y) * (P.x - C.x) + (A.x - C.x) * (P.y - C.y)) /
-                         ((B.y - C.y) * (A.x - C.x) + (C.x - B.x) * (A.y - C.y));
-            float gamma = 1.0f - alpha - beta;
-
-            if (alpha >= 0.0f && beta >= 0.0f && gamma >= 0.0f) {
+void triangle(const TriangleSetup& setup, std::vector<Fragment>& fragments) {
+    const EdgeFunction& e0 = setup.edges[0];
+    const EdgeFunction& e1 = setup.edges[1];
+    const EdgeFunction& e2 = setup.edges[2];
+
+    // Pixel centers lying on an edge that is not top-left evaluate to exactly 0 and are rejected
+    bool topLeft0 = e0.isTopLeft();
+    bool topLeft1 = e1.isTopLeft();
+    bool topLeft2 = e2.isTopLeft();
+
+    // Scalar half-space rasterization, the fallback of the SIMD rasterizers. Each edge function
+    // is evaluated as a * px + (b * py + c) with the row term computed once per row: the SIMD
+    // rasterizers evaluate the same expression per lane, so every path covers the same pixels.
+    for (int y = setup.minY; y <= setup.maxY; y++) {
+        float py = y + 0.5f;
+        float row0 = e0.b * py + e0.c;
+        float row1 = e1.b * py + e1.c;
+        float row2 = e2.b * py + e2.c;
+
+        for (int x = setup.minX; x <= setup.maxX; x++) {
+            float px = x + 0.5f;
+            float w0 = e0.a * px + row0;
+            float w1 = e1.a * px + row1;
+            float w2 = e2.a * px + row2;
+
+            // Pixel centers exactly on an edge are rare, the fill rule is only consulted for them
+            if (w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f &&
+                (w0 != 0.0f || topLeft0) && (w1 != 0.0f || topLeft1) && (w2 != 0.0f || topLeft2)) {
                 fragments.push_back(Fragment(x, y));
             }
         }
     }
-
-    return fragments;
 }
 
 Color fragmentShader(const Fragment& fragment) {
@@ -129,36 +140,285 @@ Color fragmentShader(const Fragment& fragment) {
 }
 
 
-void render(const std::vector<glm::vec3>& vertexArray, const Uniforms& uniforms) {
-    // Limpiamos el framebuffer con el color de fondo
-    clear();
+// Dirty tracking: de qué se renderizó el frame que guarda el framebuffer. Mientras nada de esto
+// cambie, el pipeline no vuelve a ejecutarse. Las mallas se comparan por identidad, así que unos
+// vértices modificados en su sitio deben llegar con una vista nueva.
+struct RetainedFrame {
+    bool valid = false;
+    Uniforms uniforms;
+    PipelineState state;
+    std::span<const uint32_t> indices;
+    VertexStreams vertexStreams;
+    int width = 0;
+    int height = 0;
+
+    static RetainedFrame of(std::span<const uint32_t> indices, const VertexStreams& vertexStreams,
+                            const Uniforms& uniforms, const PipelineState& state, const Framebuffer& framebuffer) {
+        return {true, uniforms, state, indices, vertexStreams, framebuffer.width, framebuffer.height};
+    }
 
-    // 1. Vertex Shader
-    std::vector<glm::vec3> transformedVertices;
-    for (const auto& vertex : vertexArray) {
-        // Aplicamos el vertex shader a cada vértice
-        glm::vec3 transformedVertex = vertexShader(vertex, uniforms);
-        transformedVertices.push_back(transformedVertex);
+    bool matches(std::span<const uint32_t> indices, const VertexStreams& vertexStreams, const Uniforms& uniforms,
+                 const PipelineState& state, const Framebuffer& framebuffer) const {
+        return valid && uniforms == this->uniforms && state == this->state && same(indices, this->indices) &&
+               same(vertexStreams.x, this->vertexStreams.x) && same(vertexStreams.y, this->vertexStreams.y) &&
+               same(vertexStreams.z, this->vertexStreams.z) && framebuffer.width == width &&
+               framebuffer.height == height;
     }
 
-    // 2. Primitive Assembly
-    std::vector<std::vector<glm::vec3>> triangles = primitiveAssembly(transformedVertices);
+    template <typename T>
+    static bool same(std::span<const T> a, std::span<const T> b) {
+        return a.data() == b.data() && a.size() == b.size();
+    }
+};
 
-    // 3. Rasterization
-    std::vector<Fragment> fragments = rasterize(triangles);
+// Triángulos por job de geometría: suficientes para repartir el coste de cada job, y pocos para
+// que una malla grande se reparta entre todos los hilos
+const size_t GEOMETRY_CHUNK_TRIANGLES = 2048;
 
-    // 4. Fragment Shader
-    for (const auto& fragment : fragments) {
-        // En este caso, el fragment shader simplemente asigna un color constante a cada fragmento
-        Color fragColor = fragmentShader(fragment);
-        setColor(fragColor);
+// Vértices que transforma cada job del vertex shader por lotes: cada uno recorre unos 200 KB de
+// entrada y salida, y una malla grande se reparte entre todos los hilos
+const size_t VERTEX_JOB_VERTICES = 8192;
 
-        // Dibujamos el píxel en la pantalla
-        point(fragment.position.x, fragment.position.y);
+// Salida del front-end de geometría para un frame. Hay dos, para que la geometría del frame
+// siguiente se calcule mientras se rasteriza este: cada una guarda su copia de los uniforms y del
+// estado, y sus triángulos ya preparados y repartidos en tiles
+struct FrameGeometry {
+    Uniforms uniforms;
+    PipelineState state;
+    // Todos los vértices de la malla en clip space, transformados una sola vez por frame
+    ClipSpaceStreams clipVertices;
+    std::vector<std::vector<TriangleSetup>> chunkSetups;
+    std::vector<RenderStats> chunkStats;
+    std::vector<TriangleSetup> setups;
+    TileBins bins;
+    RenderStats stats;
+    // Termina cuando setups, bins y stats están completos
+    JobHandle ready;
+};
+
+// Front-end: lanza los jobs de geometría de un frame y vuelve sin esperarlos. frame no puede
+// reutilizarse hasta que frame.ready termine. Cada tres índices de indices son un triángulo, y
+// vertexStreams son las posiciones a las que apuntan
+void submitGeometry(std::span<const uint32_t> indices, const VertexStreams& vertexStreams, const Uniforms& uniforms,
+                    const PipelineState& state, ThreadPool& threadPool, FrameGeometry& frame) {
+    // La matriz combinada ya la calcularon los setters de los uniforms
+    glm::mat4 mvp = uniforms.modelViewProjection();
+    frame.uniforms = uniforms;
+    frame.state = state;
+    frame.stats = RenderStats();
+
+    // 1. Vertex Shader por lotes: cada vértice de la malla se transforma una vez, 4, 8 o 16 a la
+    // vez según el conjunto de instrucciones SIMD, sobre rangos de vértices en paralelo
+    frame.clipVertices.resize(vertexStreams.size());
+    std::vector<JobHandle> vertexJobs;
+    for (size_t first = 0; first < vertexStreams.size(); first += VERTEX_JOB_VERTICES) {
+        size_t count = std::min(VERTEX_JOB_VERTICES, vertexStreams.size() - first);
+        vertexJobs.push_back(threadPool.submit([vertexStreams, first, count, mvp, &frame] {
+            shadeVertexStreams(vertexStreams, first, count, mvp, frame.state.simdLevel, frame.clipVertices);
+        }));
+    }
+    JobHandle verticesShaded = threadPool.submit([] {}, vertexJobs);
+
+    // 2 a 4. El resto de la geometría se procesa por bloques de triángulos, cada uno en su propio
+    // job en cuanto los vértices están listos: clipping (plano cercano y banda de guarda, antes de
+    // la división de perspectiva), primitive assembly descartando triángulos degenerados y caras
+    // traseras, y triangle setup. Un bloque no espera a que los demás terminen ninguna etapa
+    const size_t chunkIndices = 3 * GEOMETRY_CHUNK_TRIANGLES;
+    size_t chunkCount = (indices.size() + chunkIndices - 1) / chunkIndices;
+    frame.chunkSetups.resize(chunkCount);
+    frame.chunkStats.assign(chunkCount, RenderStats());
+    std::vector<JobHandle> geometryJobs;
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        geometryJobs.push_back(threadPool.submit([indices, chunk, chunkIndices, &frame] {
+            size_t first = chunk * chunkIndices;
+            std::span<const uint32_t> triangleIndices =
+                    indices.subspan(first, std::min(chunkIndices, indices.size() - first));
+            std::vector<glm::vec4> transformedVertices = gatherVertices(triangleIndices, frame.clipVertices);
+            std::vector<glm::vec4> clippedVertices = clipTriangles(transformedVertices, frame.uniforms, frame.state);
+            std::vector<std::array<glm::vec3, 3>> triangles =
+                    primitiveAssembly(clippedVertices, frame.uniforms, frame.state, frame.chunkStats[chunk]);
+            frame.chunkSetups[chunk] = triangleSetup(triangles, frame.state);
+        }, std::span<const JobHandle>(&verticesShaded, 1)));
     }
 
-    // Mostramos los cambios en pantalla
-    SDL_RenderPresent(renderer);
+    // Los bloques se juntan en el orden de los índices, que es el orden de dibujo, y se hace el
+    // binning: con latencia 1 también se solapa con la rasterización del frame anterior
+    frame.ready = threadPool.submit([&frame] {
+        size_t setupCount = 0;
+        for (const std::vector<TriangleSetup>& chunk : frame.chunkSetups) {
+            setupCount += chunk.size();
+        }
+        frame.setups.clear();
+        frame.setups.reserve(setupCount);
+        for (size_t chunk = 0; chunk < frame.chunkSetups.size(); ++chunk) {
+            frame.setups.insert(frame.setups.end(), frame.chunkSetups[chunk].begin(), frame.chunkSetups[chunk].end());
+            frame.stats.triangles += frame.chunkStats[chunk].triangles;
+            frame.stats.culledTriangles += frame.chunkStats[chunk].culledTriangles;
+            frame.stats.degenerateTriangles += frame.chunkStats[chunk].degenerateTriangles;
+        }
+        frame.bins = binTriangles(frame.setups, frame.state.scissor);
+    }, geometryJobs);
+}
+
+// Back-end: espera la geometría del frame, lo rasteriza en el framebuffer y lo presenta. Los jobs
+// de geometría de otro frame lanzados antes siguen ejecutándose en los hilos libres
+void rasterizeFrame(FrameGeometry& frame, RenderStats& stats, DepthBuffer& depthBuffer, ThreadPool& threadPool,
+                    RenderTarget& target, RasterThroughput& throughput) {
+    threadPool.wait(frame.ready);
+    stats = frame.stats;
+
+    // Limpiamos el framebuffer con el color de fondo
+    clear();
+
+    // 5 y 6. Rasterization por tiles en paralelo, con el conjunto de instrucciones SIMD elegido al
+    // arrancar, y early-Z. Los fragmentos que pasan el depth test llegan por lotes al Fragment
+    // Shader mientras siguen en caché, sin guardar nunca todos los del frame. Los tiles no comparten
+    // píxeles, así que cada hilo escribe sus colores directamente en el framebuffer
+    auto shadeBatch = [&](std::span<const Fragment> batch) {
+        for (const Fragment& fragment : batch) {
+            framebuffer.at(fragment.position.x, fragment.position.y) = fragmentShader(fragment);
+        }
+    };
+    auto rasterStart = std::chrono::steady_clock::now();
+    rasterize(frame.setups, frame.bins, frame.state, depthBuffer, stats, shadeBatch, &threadPool);
+    throughput.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - rasterStart).count();
+    throughput.coveredPixels += stats.coveredPixels;
+
+    // Mostramos los cambios en pantalla (o los guardamos, sin ventana)
+    target.present(framebuffer);
+}
+
+// --check-coverage: comprueba que la rasterización no deja huecos ni pinta dos veces un píxel en
+// las aristas compartidas. En una malla cerrada, cada píxel de cualquier vista está cubierto por
+// tantos triángulos orientados en un sentido como en el otro, así que sumando la cobertura de cada
+// triángulo con el signo de su orientación en pantalla queda cero en todos los píxeles. Cada
+// triángulo pasa por el pipeline completo (tiles incluidos), con las vistas repartidas entre todos
+// los conjuntos de instrucciones disponibles
+// Triángulos que ya dieron problemas, en coordenadas de pantalla. --check-coverage comprueba que
+// cada conjunto de instrucciones cubre exactamente los mismos píxeles que el kernel escalar
+const std::array<glm::vec3, 3> REGRESSION_TRIANGLES[] = {
+    // Alto y estrecho dentro de la banda de guarda: el paso de un bloque al siguiente no cabe en 32 bits
+    {glm::vec3(100.95f, -1800.0f, 0.5f), glm::vec3(100.2f, 0.0f, 0.5f), glm::vec3(100.951f, 2337.0f, 0.5f)},
+};
+
+bool checkCoverage(std::span<const uint32_t> indices, const VertexStreams& vertexStreams,
+                   const PipelineState& pipelineState) {
+    auto position = [&](uint32_t index) {
+        return glm::vec3(vertexStreams.x[index], vertexStreams.y[index], vertexStreams.z[index]);
+    };
+
+    // Solo es válida si cada arista dirigida tiene su opuesta; las posiciones se comparan tal cual,
+    // porque vértices con la misma posición se transforman exactamente igual
+    std::map<std::array<float, 6>, int> edges;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        for (int corner = 0; corner < 3; ++corner) {
+            glm::vec3 from = position(indices[i + corner]);
+            glm::vec3 to = position(indices[i + (corner + 1) % 3]);
+            ++edges[{from.x, from.y, from.z, to.x, to.y, to.z}];
+            --edges[{to.x, to.y, to.z, from.x, from.y, from.z}];
+        }
+    }
+    size_t openEdges = std::count_if(edges.begin(), edges.end(), [](const auto& edge) { return edge.second != 0; });
+    if (openEdges > 0) {
+        std::cerr << "check-coverage: the mesh is not closed (" << openEdges << " unmatched edges)" << std::endl;
+        return false;
+    }
+
+    // La malla se escala a la esfera unidad y se mira desde vistas aleatorias (siempre las mismas),
+    // lo bastante lejos para que no la corte el plano cercano ni se salga de la banda de guarda
+    glm::vec3 lowest = position(0);
+    glm::vec3 highest = position(0);
+    for (uint32_t index = 0; index < vertexStreams.size(); ++index) {
+        lowest = glm::min(lowest, position(index));
+        highest = glm::max(highest, position(index));
+    }
+    float radius = std::max(glm::length(highest - lowest) * 0.5f, 1e-6f);
+    glm::vec3 center = (lowest + highest) * 0.5f;
+
+    PipelineState state = pipelineState;
+    state.scissor = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+    state.cullMode = CullMode::None;
+    state.depthTest = false;
+
+    const int VIEW_COUNT = 40;
+    std::mt19937 random(2024);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<int> coverage(static_cast<size_t>(SCREEN_WIDTH) * SCREEN_HEIGHT);
+    std::vector<TriangleSetup> single(1);
+    ClipSpaceStreams clipVertices;
+    DepthBuffer depthBuffer;
+    RenderStats stats;
+    size_t badPixels = 0;
+    for (int view = 0; view < VIEW_COUNT; ++view) {
+        glm::vec3 axis(unit(random), unit(random), unit(random));
+        axis = glm::length(axis) > 1e-3f ? glm::normalize(axis) : glm::vec3(0.0f, 1.0f, 0.0f);
+        float angle = glm::pi<float>() * unit(random);
+        float distance = 4.0f + 2.0f * unit(random);
+        glm::vec2 offset(0.5f * unit(random), 0.5f * unit(random));
+
+        Uniforms uniforms;
+        uniforms.setModel(glm::rotate(glm::mat4(1.0f), angle, axis) * glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / radius)) *
+                          glm::translate(glm::mat4(1.0f), -center));
+        uniforms.setView(glm::translate(glm::mat4(1.0f), glm::vec3(offset, -distance)));
+        uniforms.setProjection(glm::perspective(glm::radians(45.0f),
+                                                static_cast<float>(SCREEN_WIDTH) / SCREEN_HEIGHT, 0.1f, 100.0f));
+        uniforms.setViewport(glm::translate(glm::mat4(1.0f), glm::vec3(SCREEN_WIDTH * 0.5f, SCREEN_HEIGHT * 0.5f, 0.0f)) *
+                             glm::scale(glm::mat4(1.0f), glm::vec3(SCREEN_WIDTH * 0.5f, SCREEN_HEIGHT * -0.5f, 1.0f)));
+        state.simdLevel = static_cast<SimdLevel>(view % (static_cast<int>(pipelineState.simdLevel) + 1));
+
+        clipVertices.resize(vertexStreams.size());
+        shadeVertexStreams(vertexStreams, 0, vertexStreams.size(), uniforms.modelViewProjection(), state.simdLevel,
+                           clipVertices);
+        std::vector<glm::vec4> clippedVertices =
+                clipTriangles(gatherVertices(indices, clipVertices), uniforms, state);
+        std::vector<TriangleSetup> setups = triangleSetup(primitiveAssembly(clippedVertices, uniforms, state, stats), state);
+
+        std::fill(coverage.begin(), coverage.end(), 0);
+        for (const TriangleSetup& setup : setups) {
+            // Orientación del triángulo que se rasteriza de verdad (ya ajustado a la rejilla): en
+            // double el producto es exacto en los modos de punto fijo
+            const glm::vec3& A = setup.vertices[0];
+            const glm::vec3& B = setup.vertices[1];
+            const glm::vec3& C = setup.vertices[2];
+            double doubleArea = (double(B.x) - A.x) * (double(C.y) - A.y) - (double(C.x) - A.x) * (double(B.y) - A.y);
+            int sign = doubleArea < 0.0 ? -1 : 1;
+
+            single[0] = setup;
+            rasterize(single, state, depthBuffer, stats, [&](std::span<const Fragment> batch) {
+                for (const Fragment& fragment : batch) {
+                    coverage[static_cast<size_t>(fragment.position.y) * SCREEN_WIDTH + fragment.position.x] += sign;
+                }
+            });
+        }
+        badPixels += std::count_if(coverage.begin(), coverage.end(), [](int value) { return value != 0; });
+    }
+
+    // Los kernels solo difieren en el orden de los fragmentos
+    auto coveredPixels = [](const TriangleSetup& setup, SimdLevel level) {
+        std::vector<Fragment> fragments;
+        rasterizeTriangle(setup, level, fragments);
+        std::vector<std::pair<int, int>> pixels;
+        for (const Fragment& fragment : fragments) {
+            pixels.emplace_back(fragment.position.y, fragment.position.x);
+        }
+        std::sort(pixels.begin(), pixels.end());
+        return pixels;
+    };
+    state.simdLevel = pipelineState.simdLevel;
+    std::vector<std::array<glm::vec3, 3>> regressionTriangles(std::begin(REGRESSION_TRIANGLES),
+                                                              std::end(REGRESSION_TRIANGLES));
+    size_t badTriangles = 0;
+    for (const TriangleSetup& setup : triangleSetup(regressionTriangles, state)) {
+        auto expected = coveredPixels(setup, SimdLevel::Scalar);
+        for (int level = 1; level <= static_cast<int>(pipelineState.simdLevel); ++level) {
+            badTriangles += coveredPixels(setup, static_cast<SimdLevel>(level)) != expected ? 1 : 0;
+        }
+    }
+
+    std::cout << "check-coverage: " << VIEW_COUNT << " views up to " << simdLevelName(pipelineState.simdLevel) << ", "
+              << badPixels << " pixels with gaps or double hits, " << badTriangles
+              << " regression triangles that differ from the scalar kernel" << std::endl;
+    return badPixels == 0 && badTriangles == 0;
 }
 
 glm::mat4 createModelMatrix(const glm::vec3& translation, const glm::vec3& rotation, const glm::vec3& scale) {
@@ -178,52 +438,6 @@ glm::mat4 createModelMatrix(const glm::vec3& translation, const glm::vec3& rotat
     return modelMatrix;
 }
 
-// Función para leer el archivo .obj y cargar los vértices y caras
-bool loadOBJ(const std::string& path, std::vector<glm::vec3>& out_vertices, std::vector<Face>& out_faces) {
-    out_vertices.clear();
-    out_faces.clear();
-
-    std::ifstream file(path);
-    if (!file.is_open()) {
-        std::cerr << "Error: Unable to open file " << path << std::endl;
-        return false;
-    }
-
-    std::string line;
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
-        std::string type;
-        iss >> type;
-
-        if (type == "v") {
-            glm::vec3 vertex;
-            iss >> vertex.x >> vertex.y >> vertex.z;
-            out_vertices.push_back(vertex);
-        } else if (type == "f") {
-            std::string lineHeader;
-            Face face;
-            while (iss >> lineHeader)
-            {
-                std::istringstream tokenstream(lineHeader);
-                std::string token;
-                std::array<int, 3> vertexIndices;
-
-                // Read all three values separated by '/'
-                for (int i = 0; i < 3; ++i) {
-                    std::getline(tokenstream, token, '/');
-                    vertexIndices[i] = std::stoi(token) - 1;
-                }
-
-                face.vertexIndices.push_back(vertexIndices);
-            }
-            out_faces.push_back(face);
-        }
-    }
-
-    file.close();
-    return true;
-}
-
 glm::mat4 createViewMatrix(const Camera& camera) {
     return glm::lookAt(camera.cameraPosition, camera.targetPosition, camera.upVector);
 }
@@ -251,39 +465,182 @@ glm::mat4 createViewportMatrix() {
     return viewport;
 }
 
-std::vector<glm::vec3> setupVertexArray(const std::vector<glm::vec3>& vertices, const std::vector<Face>& faces) {
-    std::vector<glm::vec3> vertexArray;
+IndexedVertexArray setupVertexArray(const Mesh& mesh) {
+    IndexedVertexArray vertexArray;
+
+    // Corners already emitted, chained per position index: a corner is only new if no
+    // earlier corner used the same (position, texcoord, normal) triple
+    struct WeldedCorner {
+        int texCoordIndex;
+        int normalIndex;
+        uint32_t vertexIndex;
+        int next;
+    };
+    std::vector<int> firstCorner(mesh.positions.size(), -1);
+    std::vector<WeldedCorner> corners;
+    std::vector<uint32_t> faceIndices;
 
     // For each face
-    for (const auto& face : faces) {
+    for (size_t face = 0; face < mesh.faceCount(); ++face) {
+        faceIndices.clear();
+
         // For each vertex in the face
-        for (const auto& vertexIndices : face.vertexIndices) {
-            // Get the vertex position from the input array using the indices from the face
-            glm::vec3 vertexPosition = vertices[vertexIndices[0]];
+        for (uint32_t i = mesh.faceOffsets[face]; i < mesh.faceOffsets[face + 1]; ++i) {
+            int positionIndex = mesh.positionIndices[i];
+            int texCoordIndex = mesh.texCoordIndices[i];
+            int normalIndex = mesh.normalIndices[i];
+            if (positionIndex < 0 || static_cast<size_t>(positionIndex) >= mesh.positions.size()) {
+                break;
+            }
+
+            int corner = firstCorner[positionIndex];
+            while (corner != -1 && (corners[corner].texCoordIndex != texCoordIndex ||
+                                    corners[corner].normalIndex != normalIndex)) {
+                corner = corners[corner].next;
+            }
+
+            if (corner == -1) {
+                // First time we see this triple: add the vertex to the vertex buffer
+                auto vertexIndex = static_cast<uint32_t>(vertexArray.vertices.size());
+                vertexArray.vertices.push_back(mesh.positions[positionIndex]);
+                corners.push_back({texCoordIndex, normalIndex, vertexIndex, firstCorner[positionIndex]});
+                corner = static_cast<int>(corners.size()) - 1;
+                firstCorner[positionIndex] = corner;
+            }
+            faceIndices.push_back(corners[corner].vertexIndex);
+        }
 
-            // Add the vertex position to the vertex array
-            vertexArray.push_back(vertexPosition);
+        // Faces with invalid indices are skipped, polygons are split into a triangle fan
+        if (faceIndices.size() != mesh.faceOffsets[face + 1] - mesh.faceOffsets[face]) {
+            continue;
+        }
+        for (size_t i = 2; i < faceIndices.size(); ++i) {
+            vertexArray.indices.push_back(faceIndices[0]);
+            vertexArray.indices.push_back(faceIndices[i - 1]);
+            vertexArray.indices.push_back(faceIndices[i]);
         }
     }
 
     return vertexArray;
 }
 
+// Lee un argumento entero: falla si no es un número, si le sobra texto o si no está en
+// [minimum, maximum]
+bool parseInteger(std::string_view text, int minimum, int maximum, int& out) {
+    int value = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size() || value < minimum || value > maximum) {
+        return false;
+    }
+    out = value;
+    return true;
+}
+
 int main(int argc, char* argv[]) {
-    init();
+    // --headless: sin ventana ni SDL, renderiza --frames frames (100 por defecto) y termina,
+    // escribiendo el último en --output si se indica. --threads fija el número de hilos, de 1 a
+    // cuatro por hilo de hardware (uno por hilo de hardware por defecto), y --pin ata cada hilo a una CPU. --latency 1 (por defecto)
+    // calcula la geometría de un frame mientras se rasteriza el anterior; --latency 0 no los solapa.
+    // --check-coverage no renderiza: comprueba que la malla se rasteriza sin huecos y termina
+    bool headless = false;
+    bool coverageCheck = false;
+    int frameLimit = 100;
+    std::string outputPath;
+    int threadCount = 0;
+    bool pinThreads = false;
+    int frameLatency = 1;
+    // Hasta cuatro hilos por hilo de hardware: más solo reparte el mismo trabajo en más colas
+    const int maxThreads = 4 * static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        bool valid = true;
+        if (argument == "--headless") {
+            headless = true;
+        } else if (argument == "--frames" && i + 1 < argc) {
+            valid = parseInteger(argv[++i], 1, std::numeric_limits<int>::max(), frameLimit);
+        } else if (argument == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (argument == "--threads" && i + 1 < argc) {
+            valid = parseInteger(argv[++i], 1, maxThreads, threadCount);
+        } else if (argument == "--pin") {
+            pinThreads = true;
+        } else if (argument == "--latency" && i + 1 < argc) {
+            valid = parseInteger(argv[++i], 0, 1, frameLatency);
+        } else if (argument == "--check-coverage") {
+            headless = true;
+            coverageCheck = true;
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--headless [--frames N] [--output image.ppm]] [--threads N] [--pin] [--latency 0|1]"
+                      << " [--check-coverage]"
+                      << std::endl;
+            return -1;
+        }
+    }
+
+    framebuffer.resize(SCREEN_WIDTH, SCREEN_HEIGHT);
+    std::unique_ptr<RenderTarget> target;
+    if (!headless) {
+        target = std::make_unique<WindowTarget>("Software Renderer", SCREEN_WIDTH, SCREEN_HEIGHT);
+    } else if (!outputPath.empty()) {
+        // Un --output que no se puede escribir falla antes de renderizar nada
+        auto file = std::make_unique<PpmFileTarget>(outputPath);
+        if (!file->isOpen()) {
+            std::cerr << "Error: Unable to write " << outputPath << std::endl;
+            return -1;
+        }
+        target = std::move(file);
+    } else {
+        target = std::make_unique<ImageTarget>();
+    }
+
+    // Carga del OBJ, geometría, tiles y fragment shader se reparten como jobs entre todos los hilos
+    ThreadPool threadPool(static_cast<unsigned>(threadCount), pinThreads);
 
     std::string currentPath = getCurrentPath();
     std::string fileName = "naveLab3.obj";
     std::string filePath = getParentDirectory(currentPath) + "\\" + fileName;
 
-    bool success = loadOBJ(filePath, vertices, faces);
+    // Usamos la caché binaria si está al día; si no, se lee el OBJ y se escribe una caché nueva
+    MeshCache meshCache;
+    IndexedVertexArray builtVertexArray;
+    VertexStreamStorage builtVertexStreams;
+    std::span<const uint32_t> indices;
+    VertexStreams vertexStreams;
+
+    // El ACMR mide la localidad de los índices, no el coste del render: el vertex shader por lotes
+    // transforma cada vértice una sola vez por frame, en cualquier orden
+    if (loadMeshCache(filePath, meshCache)) {
+        indices = meshCache.indices;
+        vertexStreams = meshCache.vertexStreams;
+        std::cout << fileName << ": index locality, ACMR " << computeACMR(indices) << " (cached)" << std::endl;
+    } else {
+        bool success = loadOBJ(filePath, mesh, &threadPool);
+
+        if (!success) {
+            std::cerr << "Error: Unable to load OBJ file " << filePath << std::endl;
+            return -1;
+        }
 
-    if (!success) {
-        std::cerr << "Error: Unable to load OBJ file " << filePath << std::endl;
-        return -1;
-    }
+        builtVertexArray = setupVertexArray(mesh);
 
-    std::vector<glm::vec3> vertexArray = setupVertexArray(vertices, faces);
+        // Reordenamos los triángulos para que cada bloque lea vértices cercanos antes de guardarlos en disco
+        float acmrBefore = computeACMR(builtVertexArray.indices);
+        optimizeVertexCache(builtVertexArray.indices, builtVertexArray.vertices.size());
+        float acmrAfter = computeACMR(builtVertexArray.indices);
+        std::cout << fileName << ": index locality, ACMR " << acmrBefore << " -> " << acmrAfter << std::endl;
+
+        // El vertex shader por lotes lee cada coordenada de su propio array, y la caché las guarda
+        // así para que las próximas ejecuciones las usen sin convertirlas
+        builtVertexStreams = splitVertexStreams(builtVertexArray.vertices);
+        indices = builtVertexArray.indices;
+        vertexStreams = builtVertexStreams;
+        writeMeshCache(filePath, vertexStreams, indices);
+    }
 
     /* vertices = {
             {300.0f, 200.0f, 0.0f},
@@ -334,31 +691,126 @@ int main(int argc, char* argv[]) {
 
     // Crear la estructura de uniformes y asignar las matrices
     Uniforms uniforms;
-    uniforms.model = modelMatrix;
-    uniforms.view = viewMatrix;
-    uniforms.projection = projectionMatrix;
-    uniforms.viewport = viewportMatrix;
-
-    bool running = true;
-    while (running) {
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) {
-                running = false;
+    uniforms.setModel(modelMatrix);
+    uniforms.setView(viewMatrix);
+    uniforms.setProjection(projectionMatrix);
+    uniforms.setViewport(viewportMatrix);
+
+    // Todo el framebuffer es visible
+    PipelineState pipelineState;
+    pipelineState.scissor = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+    pipelineState.cullMode = CullMode::Back;
+    pipelineState.simdLevel = detectSimdLevel();
+    pipelineState.subpixelPrecision = SubpixelPrecision::Fixed8; // Sin grietas entre triángulos vecinos
+    pipelineState.depthTest = true; // Gana el fragmento más cercano, sin importar el orden de los triángulos
+    pipelineState.depthCompare = CompareOp::Less;
+    if (coverageCheck) {
+        return checkCoverage(indices, vertexStreams, pipelineState) ? 0 : 1;
+    }
+    DepthBuffer depthBuffer;
+
+    std::cout << "Rasterizer: " << simdLevelName(pipelineState.simdLevel) << ", " << threadPool.threadCount()
+              << " threads" << std::endl;
+
+    RenderStats stats;
+    RenderStats lastStats;
+    RasterThroughput throughput;
+    throughput.cores = threadPool.threadCount();
+    auto throughputStart = std::chrono::steady_clock::now();
+
+    // Back-end de un frame, con las estadísticas del frame solo cuando cambian y el rendimiento del
+    // rasterizador y la ocupación de cada hilo una vez por segundo
+    int frame = 0;
+    auto finishFrame = [&](FrameGeometry& geometry) {
+        rasterizeFrame(geometry, stats, depthBuffer, threadPool, *target, throughput);
+        ++frame;
+
+        if (!(stats == lastStats)) {
+            std::cout << "triangles " << stats.triangles << ", culled " << stats.culledTriangles
+                      << ", degenerate " << stats.degenerateTriangles << ", covered pixels " << stats.coveredPixels;
+            if (stats.coveredPixels > 0) {
+                std::cout << " (" << 100.0 * stats.acceptedBlockPixels / stats.coveredPixels << "% trivially accepted)"
+                          << ", shaded " << stats.shadedFragments << " ("
+                          << 100.0 * stats.shadedFragments / stats.coveredPixels << "% of rasterized)";
             }
+            if (stats.hiZRejectedPixels > 0) {
+                std::cout << ", Hi-Z rejected " << stats.hiZRejectedPixels << " pixels";
+            }
+            std::cout << std::endl;
+            lastStats = stats;
         }
 
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
+        if (std::chrono::steady_clock::now() - throughputStart >= std::chrono::seconds(1)) {
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - throughputStart).count();
+            std::cout << "raster: " << throughput.pixelsPerSecondPerCore() / 1e6 << " Mpixels/s per core, busy";
+            for (const WorkerStats& worker : threadPool.workerStats()) {
+                std::cout << " " << static_cast<int>(100.0 * worker.busySeconds / elapsed) << "%";
+            }
+            std::cout << std::endl;
+            threadPool.resetWorkerStats();
+            throughput = RasterThroughput();
+            throughput.cores = threadPool.threadCount();
+            throughputStart = std::chrono::steady_clock::now();
+        }
+    };
+
+    // Con ventana, un frame sin cambios no se vuelve a renderizar: se presenta de nuevo el framebuffer
+    // si la ventana lo perdió, y si no el bucle duerme hasta el siguiente evento. Sin ventana se
+    // renderizan todos los frames, para medir el pipeline. Con latencia 1, la geometría del frame
+    // nuevo se lanza antes de rasterizar el anterior, y los dos avanzan a la vez en los hilos
+    FrameGeometry geometry[2];
+    FrameGeometry* inFlight = nullptr;
+    int submitted = 0;
+    RetainedFrame retained;
+    bool idle = false;
+    auto renderStart = std::chrono::steady_clock::now();
+    while (target->processEvents(idle) && (!headless || frame < frameLimit)) {
+        bool changed = headless ? submitted < frameLimit
+                                : !retained.matches(indices, vertexStreams, uniforms, pipelineState, framebuffer);
+        idle = false;
+        if (changed) {
+            // El otro buffer es el del frame en vuelo, si lo hay
+            FrameGeometry& next = geometry[submitted % 2];
+            submitGeometry(indices, vertexStreams, uniforms, pipelineState, threadPool, next);
+            retained = RetainedFrame::of(indices, vertexStreams, uniforms, pipelineState, framebuffer);
+            ++submitted;
+            if (frameLatency == 0) {
+                finishFrame(next);
+            } else {
+                FrameGeometry* previous = inFlight;
+                inFlight = &next;
+                if (previous != nullptr) {
+                    finishFrame(*previous);
+                }
+            }
+        } else if (inFlight != nullptr) {
+            // Ya no llegan frames nuevos: se termina el que quedaba en vuelo
+            finishFrame(*inFlight);
+            inFlight = nullptr;
+        } else {
+            if (target->needsPresent()) {
+                target->present(framebuffer);
+            }
+            idle = true;
+        }
+    }
 
-        render(vertexArray, uniforms); // Renderizar el triángulo con las matrices de transformación
+    // Al cerrar la ventana, la geometría en vuelo debe terminar antes de destruir sus buffers
+    if (inFlight != nullptr) {
+        threadPool.wait(inFlight->ready);
+    }
 
-        SDL_RenderPresent(renderer);
+    if (headless) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+        std::cout << frame << " frames in " << seconds << " s (" << 1e3 * seconds / std::max(frame, 1)
+                  << " ms per frame)" << std::endl;
     }
 
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    // Sin ventana, el último frame se escribe ahora, fuera del tiempo medido
+    if (!target->finish()) {
+        std::cerr << "Error: Unable to write " << outputPath << std::endl;
+        return -1;
+    }
 
     return 0;
 }
\ No newline at end of file
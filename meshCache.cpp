@@ -0,0 +1,218 @@
+#include "meshCache.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// File layout: header, section table, then each section's array starting on a 16-byte
+// boundary. Everything is stored in native byte order; a cache is not meant to be shared
+// between machines.
+static const char MESH_CACHE_MAGIC[8] = {'R', 'P', 'M', 'E', 'S', 'H', '\r', '\n'};
+static const uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+// Version 3 stored the positions interleaved in one section; ids are not reused
+enum MeshCacheSectionId : uint32_t {
+    SECTION_INDICES = 2,
+    SECTION_POSITIONS_X = 3,
+    SECTION_POSITIONS_Y = 4,
+    SECTION_POSITIONS_Z = 5,
+};
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sectionCount;
+    uint64_t sourceSize;
+    int64_t sourceModified;
+};
+
+struct MeshCacheSection {
+    uint32_t id;
+    uint32_t elementSize;
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct MeshCacheSource {
+    uint64_t size;
+    int64_t modified;
+};
+
+static bool statSource(const std::string& sourcePath, MeshCacheSource& out) {
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(sourcePath, error);
+    if (error) {
+        return false;
+    }
+    auto modified = std::filesystem::last_write_time(sourcePath, error);
+    if (error) {
+        return false;
+    }
+    out.size = static_cast<uint64_t>(size);
+    out.modified = static_cast<int64_t>(modified.time_since_epoch().count());
+    return true;
+}
+
+// Unique per process, so two processes writing the same cache never share a temporary file
+static std::string tempCachePath(const std::string& cachePath) {
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = static_cast<int>(getpid());
+#endif
+    return cachePath + "." + std::to_string(pid) + ".tmp";
+}
+
+static uint64_t alignUp(uint64_t value) {
+    return (value + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1);
+}
+
+std::string meshCachePath(const std::string& sourcePath) {
+    return std::filesystem::path(sourcePath).replace_extension(".rpmesh").string();
+}
+
+// Looks up a section and checks that it lies inside the file and has the expected element size
+template <typename T>
+static bool findSection(const MappedFile& file, uint32_t id, std::span<const T>& out) {
+    const auto* header = reinterpret_cast<const MeshCacheHeader*>(file.data);
+    const auto* sections = reinterpret_cast<const MeshCacheSection*>(file.data + sizeof(MeshCacheHeader));
+
+    for (uint32_t i = 0; i < header->sectionCount; ++i) {
+        const MeshCacheSection& section = sections[i];
+        if (section.id != id) {
+            continue;
+        }
+        if (section.elementSize != sizeof(T) || section.offset % MESH_CACHE_ALIGNMENT != 0 ||
+            section.offset > file.size || section.count > (file.size - section.offset) / sizeof(T)) {
+            return false;
+        }
+        out = std::span<const T>(reinterpret_cast<const T*>(file.data + section.offset), section.count);
+        return true;
+    }
+    return false;
+}
+
+bool loadMeshCache(const std::string& sourcePath, MeshCache& out) {
+    MeshCacheSource source;
+    if (!statSource(sourcePath, source)) {
+        return false;
+    }
+
+    MappedFile file(meshCachePath(sourcePath));
+    if (!file.isOpen() || file.size < sizeof(MeshCacheHeader)) {
+        return false;
+    }
+
+    const auto* header = reinterpret_cast<const MeshCacheHeader*>(file.data);
+    if (std::memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0 ||
+        header->version != MESH_CACHE_VERSION ||
+        header->sourceSize != source.size || header->sourceModified != source.modified) {
+        return false;
+    }
+    if (header->sectionCount > (file.size - sizeof(MeshCacheHeader)) / sizeof(MeshCacheSection)) {
+        return false;
+    }
+
+    MeshCache cache;
+    cache.file = std::move(file);
+    if (!findSection(cache.file, SECTION_POSITIONS_X, cache.vertexStreams.x) ||
+        !findSection(cache.file, SECTION_POSITIONS_Y, cache.vertexStreams.y) ||
+        !findSection(cache.file, SECTION_POSITIONS_Z, cache.vertexStreams.z) ||
+        !findSection(cache.file, SECTION_INDICES, cache.indices)) {
+        return false;
+    }
+
+    // A stale or corrupt cache could point past the vertex streams: rebuild it from the source instead
+    const size_t vertexCount = cache.vertexStreams.size();
+    if (cache.vertexStreams.y.size() != vertexCount || cache.vertexStreams.z.size() != vertexCount ||
+        cache.indices.size() % 3 != 0) {
+        return false;
+    }
+    for (uint32_t index : cache.indices) {
+        if (index >= vertexCount) {
+            return false;
+        }
+    }
+
+    out = std::move(cache);
+    return true;
+}
+
+bool writeMeshCache(const std::string& sourcePath, const VertexStreams& vertexStreams,
+                    std::span<const uint32_t> indices) {
+    MeshCacheSource source;
+    if (!statSource(sourcePath, source)) {
+        return false;
+    }
+
+    struct SectionData {
+        uint32_t id;
+        uint32_t elementSize;
+        const void* data;
+        uint64_t count;
+    };
+    const SectionData sectionData[] = {
+        {SECTION_POSITIONS_X, sizeof(float), vertexStreams.x.data(), vertexStreams.x.size()},
+        {SECTION_POSITIONS_Y, sizeof(float), vertexStreams.y.data(), vertexStreams.y.size()},
+        {SECTION_POSITIONS_Z, sizeof(float), vertexStreams.z.data(), vertexStreams.z.size()},
+        {SECTION_INDICES, sizeof(uint32_t), indices.data(), indices.size()},
+    };
+    const uint32_t sectionCount = sizeof(sectionData) / sizeof(sectionData[0]);
+
+    MeshCacheHeader header {};
+    std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+    header.version = MESH_CACHE_VERSION;
+    header.sectionCount = sectionCount;
+    header.sourceSize = source.size;
+    header.sourceModified = source.modified;
+
+    MeshCacheSection sections[sectionCount] {};
+    uint64_t offset = sizeof(MeshCacheHeader) + sizeof(sections);
+    for (uint32_t i = 0; i < sectionCount; ++i) {
+        offset = alignUp(offset);
+        sections[i] = {sectionData[i].id, sectionData[i].elementSize, offset, sectionData[i].count};
+        offset += sectionData[i].elementSize * sectionData[i].count;
+    }
+
+    // Write next to the final file and rename, so a concurrent startup never maps a half-written cache
+    const std::string cachePath = meshCachePath(sourcePath);
+    const std::string tempPath = tempCachePath(cachePath);
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Warning: Unable to write mesh cache " << cachePath << std::endl;
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(sections), sizeof(sections));
+        const char padding[MESH_CACHE_ALIGNMENT] = {};
+        for (uint32_t i = 0; i < sectionCount; ++i) {
+            file.write(padding, static_cast<std::streamsize>(sections[i].offset - static_cast<uint64_t>(file.tellp())));
+            file.write(static_cast<const char*>(sectionData[i].data),
+                       static_cast<std::streamsize>(sectionData[i].elementSize * sectionData[i].count));
+        }
+        if (!file) {
+            std::cerr << "Warning: Unable to write mesh cache " << cachePath << std::endl;
+            file.close();
+            std::filesystem::remove(tempPath);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, cachePath, error);
+    if (error) {
+        std::cerr << "Warning: Unable to write mesh cache " << cachePath << ": " << error.message() << std::endl;
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "objLoader.hpp"
+#include "vertexStreams.hpp"
+#include <span>
+#include <string>
+
+// Bump whenever the layout of the cache file or of any stored array changes
+const uint32_t MESH_CACHE_VERSION = 4;
+
+// A .rpmesh file mapped into memory. The vertex streams and indices point straight into the
+// mapping, already in the layout the pipeline reads, and stay valid for as long as the
+// MeshCache is alive.
+struct MeshCache {
+    MappedFile file;
+    VertexStreams vertexStreams;
+    std::span<const uint32_t> indices;
+};
+
+// "model.obj" -> "model.rpmesh", next to the source file
+std::string meshCachePath(const std::string& sourcePath);
+
+// Maps the cache of sourcePath. Fails if there is no cache, if it was written by another
+// version or for a source file whose size or modification time has changed since, or if any
+// index is out of range of its vertices.
+bool loadMeshCache(const std::string& sourcePath, MeshCache& out);
+
+// Writes the arrays the pipeline consumes, stamped with the current size and modification
+// time of sourcePath
+bool writeMeshCache(const std::string& sourcePath, const VertexStreams& vertexStreams,
+                    std::span<const uint32_t> indices);
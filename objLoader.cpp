@@ -0,0 +1,351 @@
+#include "objLoader.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    fileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        close();
+        return;
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+
+    // Windows refuses to map an empty file, an empty view is still a valid result
+    if (size > 0) {
+        mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr) {
+            close();
+            return;
+        }
+        data = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+        if (data == nullptr) {
+            close();
+            return;
+        }
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat fileStat {};
+    if (fstat(fd, &fileStat) != 0) {
+        ::close(fd);
+        return;
+    }
+    size = static_cast<size_t>(fileStat.st_size);
+
+    // mmap refuses a zero-length mapping, an empty view is still a valid result
+    if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            size = 0;
+            return;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapped);
+    }
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+#endif
+    opened = true;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+        opened = std::exchange(other.opened, false);
+#ifdef _WIN32
+        fileHandle = std::exchange(other.fileHandle, nullptr);
+        mappingHandle = std::exchange(other.mappingHandle, nullptr);
+#endif
+    }
+    return *this;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (data != nullptr) {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle != nullptr) {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle != nullptr) {
+        CloseHandle(fileHandle);
+    }
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    if (data != nullptr) {
+        munmap(const_cast<char*>(data), size);
+    }
+#endif
+    data = nullptr;
+    size = 0;
+    opened = false;
+}
+
+// Spaces, tabs and the '\r' of CRLF files separate tokens; '\n' ends the line
+static bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char* skipBlanks(const char* p, const char* end) {
+    while (p < end && isBlank(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+static const char* nextLine(const char* p, const char* end) {
+    const void* newline = std::memchr(p, '\n', static_cast<size_t>(end - p));
+    return newline != nullptr ? static_cast<const char*>(newline) + 1 : end;
+}
+
+// Returns nullptr if no number could be read
+static const char* parseFloat(const char* p, const char* end, float& value) {
+    p = skipBlanks(p, end);
+    // std::from_chars does not accept an explicit plus sign
+    if (p < end && *p == '+') {
+        ++p;
+    }
+    auto [next, error] = std::from_chars(p, end, value);
+    return error == std::errc() ? next : nullptr;
+}
+
+// Converts a one-based (or negative, relative) OBJ index into a zero-based one. Relative
+// indices are resolved against count, the number of records seen so far in the chunk.
+static const char* parseIndex(const char* p, const char* end, int count, int& index, bool& relative) {
+    int value = 0;
+    auto [next, error] = std::from_chars(p, end, value);
+    if (error != std::errc() || value == 0) {
+        return nullptr;
+    }
+    relative = value < 0;
+    index = relative ? count + value : value - 1;
+    return next;
+}
+
+// Parses one "v", "v/vt", "v//vn" or "v/vt/vn" face corner. Bit i of relativeMask is set
+// when component i was given as a relative index.
+static const char* parseCorner(const char* p, const char* end, const std::array<int, 3>& counts,
+                               std::array<int, 3>& corner, unsigned& relativeMask) {
+    corner = {-1, -1, -1};
+    relativeMask = 0;
+    bool relative = false;
+    p = parseIndex(p, end, counts[0], corner[0], relative);
+    relativeMask |= relative ? 1u : 0u;
+    for (int i = 1; i < 3 && p != nullptr && p < end && *p == '/'; ++i) {
+        ++p;
+        if (p < end && *p != '/' && !isBlank(*p) && *p != '\n') {
+            p = parseIndex(p, end, counts[i], corner[i], relative);
+            relativeMask |= relative ? (1u << i) : 0u;
+        }
+    }
+    return p;
+}
+
+// A face component given as a relative index. It was resolved against the chunk's own
+// counts and still needs the counts of all earlier chunks added.
+struct RelativeIndex {
+    uint32_t corner;
+    uint32_t component;
+};
+
+// The part of an OBJ file between two line boundaries, parsed independently of the others
+struct ObjChunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+
+    Mesh mesh;
+    std::vector<RelativeIndex> relativeIndices;
+    // Number of v, vt and vn records in this chunk
+    std::array<int, 3> counts = {0, 0, 0};
+
+    // Start of the offending line if parsing failed
+    const char* error = nullptr;
+};
+
+static void parseChunk(ObjChunk& chunk) {
+    Mesh& mesh = chunk.mesh;
+    std::array<int, 3>& counts = chunk.counts;
+
+    const char* end = chunk.end;
+    for (const char* p = chunk.begin; p < end; p = nextLine(p, end)) {
+        const char* line = skipBlanks(p, end);
+        if (end - line < 2) {
+            continue;
+        }
+
+        const char* cursor = nullptr;
+        if (line[0] == 'v' && isBlank(line[1])) {
+            glm::vec3 vertex;
+            cursor = parseFloat(line + 1, end, vertex.x);
+            cursor = cursor ? parseFloat(cursor, end, vertex.y) : nullptr;
+            cursor = cursor ? parseFloat(cursor, end, vertex.z) : nullptr;
+            if (cursor == nullptr) {
+                chunk.error = p;
+                return;
+            }
+            mesh.positions.push_back(vertex);
+            ++counts[0];
+        } else if (line[0] == 'v' && line[1] == 't' && (line + 2 == end || isBlank(line[2]))) {
+            ++counts[1];
+        } else if (line[0] == 'v' && line[1] == 'n' && (line + 2 == end || isBlank(line[2]))) {
+            ++counts[2];
+        } else if (line[0] == 'f' && isBlank(line[1])) {
+            cursor = skipBlanks(line + 1, end);
+            while (cursor != nullptr && cursor < end && *cursor != '\n') {
+                std::array<int, 3> corner;
+                unsigned relativeMask = 0;
+                cursor = parseCorner(cursor, end, counts, corner, relativeMask);
+                if (cursor != nullptr) {
+                    auto cornerIndex = static_cast<uint32_t>(mesh.positionIndices.size());
+                    for (uint32_t component = 0; component < 3; ++component) {
+                        if (relativeMask & (1u << component)) {
+                            chunk.relativeIndices.push_back({cornerIndex, component});
+                        }
+                    }
+                    mesh.positionIndices.push_back(corner[0]);
+                    mesh.texCoordIndices.push_back(corner[1]);
+                    mesh.normalIndices.push_back(corner[2]);
+                    cursor = skipBlanks(cursor, end);
+                }
+            }
+            if (cursor == nullptr) {
+                chunk.error = p;
+                return;
+            }
+            mesh.faceOffsets.push_back(static_cast<uint32_t>(mesh.positionIndices.size()));
+        }
+    }
+}
+
+// Chunks smaller than this are not worth a job of their own
+static const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+bool loadOBJ(const std::string& path, Mesh& out_mesh, ThreadPool* threadPool) {
+    out_mesh.clear();
+
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        std::cerr << "Error: Unable to open file " << path << std::endl;
+        return false;
+    }
+
+    size_t threadCount = threadPool != nullptr ? threadPool->threadCount() : 1;
+    size_t chunkCount = std::clamp<size_t>(file.size / MIN_CHUNK_SIZE, 1, threadCount);
+
+    // Split on line boundaries so that every chunk starts at the beginning of a record
+    const char* end = file.data + file.size;
+    std::vector<ObjChunk> chunks(chunkCount);
+    const char* chunkBegin = file.data;
+    for (size_t i = 0; i < chunkCount; ++i) {
+        const char* chunkEnd = end;
+        if (i + 1 < chunkCount) {
+            chunkEnd = std::max(chunkBegin, file.data + file.size / chunkCount * (i + 1));
+            chunkEnd = chunkEnd < end ? nextLine(chunkEnd, end) : end;
+        }
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+
+    if (chunkCount == 1) {
+        parseChunk(chunks[0]);
+    } else {
+        threadPool->parallelFor(chunkCount, [&](size_t i) { parseChunk(chunks[i]); });
+    }
+
+    // Report the first error in file order, counting lines only now that it is needed
+    for (const ObjChunk& chunk : chunks) {
+        if (chunk.error != nullptr) {
+            size_t lineNumber = std::count(file.data, chunk.error, '\n') + 1;
+            std::cerr << "Error: Malformed OBJ record in " << path << " at line " << lineNumber << std::endl;
+            return false;
+        }
+    }
+
+    // A single chunk already is the whole mesh
+    if (chunkCount == 1) {
+        out_mesh = std::move(chunks[0].mesh);
+        return true;
+    }
+
+    // Merge in file order. Absolute indices are already global; relative ones are offset by the
+    // number of records in all earlier chunks, which is what fixes up faces that refer back
+    // across a chunk boundary (e.g. when the boundary falls between the v and f sections).
+    size_t positionCount = 0;
+    size_t cornerCount = 0;
+    size_t faceCount = 0;
+    for (const ObjChunk& chunk : chunks) {
+        positionCount += chunk.mesh.positions.size();
+        cornerCount += chunk.mesh.positionIndices.size();
+        faceCount += chunk.mesh.faceCount();
+    }
+    out_mesh.positions.reserve(positionCount);
+    out_mesh.positionIndices.reserve(cornerCount);
+    out_mesh.texCoordIndices.reserve(cornerCount);
+    out_mesh.normalIndices.reserve(cornerCount);
+    out_mesh.faceOffsets.reserve(faceCount + 1);
+
+    std::array<int, 3> base = {0, 0, 0};
+    for (ObjChunk& chunk : chunks) {
+        Mesh& mesh = chunk.mesh;
+        std::array<std::vector<int>*, 3> indices = {&mesh.positionIndices, &mesh.texCoordIndices, &mesh.normalIndices};
+        for (const RelativeIndex& relative : chunk.relativeIndices) {
+            (*indices[relative.component])[relative.corner] += base[relative.component];
+        }
+        for (int i = 0; i < 3; ++i) {
+            base[i] += chunk.counts[i];
+        }
+
+        auto cornerBase = static_cast<uint32_t>(out_mesh.positionIndices.size());
+        for (size_t face = 1; face < mesh.faceOffsets.size(); ++face) {
+            out_mesh.faceOffsets.push_back(cornerBase + mesh.faceOffsets[face]);
+        }
+        out_mesh.positions.insert(out_mesh.positions.end(), mesh.positions.begin(), mesh.positions.end());
+        out_mesh.positionIndices.insert(out_mesh.positionIndices.end(), mesh.positionIndices.begin(), mesh.positionIndices.end());
+        out_mesh.texCoordIndices.insert(out_mesh.texCoordIndices.end(), mesh.texCoordIndices.begin(), mesh.texCoordIndices.end());
+        out_mesh.normalIndices.insert(out_mesh.normalIndices.end(), mesh.normalIndices.begin(), mesh.normalIndices.end());
+        mesh.clear();
+    }
+
+    return true;
+}
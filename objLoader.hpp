@@ -0,0 +1,40 @@
+#pragma once
+
+#include "shaders.hpp"
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. The loader parses straight out of the
+// mapped pages, so there is no intermediate std::string or stream buffer.
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    bool isOpen() const { return opened; }
+
+private:
+    void close();
+
+    bool opened = false;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+// Reads the positions ("v") and faces ("f") of a Wavefront .obj file. Face corners are
+// stored as zero-based position, texcoord and normal indices, with -1 for a missing
+// component ("v//vn", "v/vt" or plain "v"). Negative (relative) OBJ indices are resolved.
+// Large files are split on line boundaries and parsed in parallel on threadPool (serially
+// without one); the result is identical to a serial parse.
+bool loadOBJ(const std::string& path, Mesh& out_mesh, ThreadPool* threadPool = nullptr);
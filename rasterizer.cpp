@@ -0,0 +1,891 @@
+#include "rasterizer.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RASTERIZER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only allow intrinsics of the instruction sets a function is compiled for, so
+// each kernel enables its own. MSVC allows any intrinsic anywhere.
+#if defined(__GNUC__)
+#define RASTERIZER_TARGET(isa) __attribute__((target(isa)))
+#else
+#define RASTERIZER_TARGET(isa)
+#endif
+
+#ifdef RASTERIZER_X86
+
+#ifdef _MSC_VER
+static SimdLevel detectCpuSimdLevel() {
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!sse41) {
+        return SimdLevel::Scalar;
+    }
+    if (!osxsave || maxLeaf < 7) {
+        return SimdLevel::SSE41;
+    }
+
+    // The OS has to save the YMM (and ZMM) registers on context switches for AVX to be usable
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+    bool avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+    if (avx512) {
+        return SimdLevel::AVX512;
+    }
+    return avx2 ? SimdLevel::AVX2 : SimdLevel::SSE41;
+}
+#else
+static SimdLevel detectCpuSimdLevel() {
+    // Also checks that the OS saves the wider registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SimdLevel::SSE41;
+    }
+    return SimdLevel::Scalar;
+}
+#endif
+
+// Lanes of a blockWidth x 2 block that lie inside the bounding box: lane i is pixel
+// (i % blockWidth, i / blockWidth) of the block
+static int blockLaneMask(int blockWidth, int columns, int rows) {
+    int rowMask = (1 << (columns < blockWidth ? columns : blockWidth)) - 1;
+    return rows > 1 ? rowMask | (rowMask << blockWidth) : rowMask;
+}
+
+static void emitBlock(int mask, int x, int y, int blockWidth, std::vector<Fragment>& fragments) {
+    while (mask != 0) {
+        int lane = std::countr_zero(static_cast<unsigned>(mask));
+        mask &= mask - 1;
+        fragments.push_back(Fragment(x + lane % blockWidth, y + lane / blockWidth));
+    }
+}
+// The kernels below all walk the bounding box in blocks two rows high. Per block and edge the
+// edge function is a * px + (b * py + c), rounded exactly like triangle() does it, and a lane
+// is covered when all three are >= 0 and none of the zeros lies on an edge that is not
+// top-left. The zero check only runs for blocks with any coverage. This file is built without
+// floating-point contraction (see CMakeLists.txt): a fused multiply-add would round differently.
+
+RASTERIZER_TARGET("sse4.1")
+static void rasterizeTriangleSSE41(const TriangleSetup& setup, std::vector<Fragment>& fragments) {
+    const int BLOCK_WIDTH = 2;
+    const __m128 laneX = _mm_setr_ps(0.0f, 1.0f, 0.0f, 1.0f);
+    const __m128 laneY = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+    const __m128 step = _mm_set1_ps(static_cast<float>(BLOCK_WIDTH));
+    const __m128 zero = _mm_setzero_ps();
+
+    __m128 a[3], b[3], c[3], notTopLeft[3];
+    for (int i = 0; i < 3; ++i) {
+        const EdgeFunction& edge = setup.edges[i];
+        a[i] = _mm_set1_ps(edge.a);
+        b[i] = _mm_set1_ps(edge.b);
+        c[i] = _mm_set1_ps(edge.c);
+        notTopLeft[i] = _mm_castsi128_ps(_mm_set1_epi32(edge.isTopLeft() ? 0 : -1));
+    }
+
+    for (int y = setup.minY; y <= setup.maxY; y += 2) {
+        __m128 py = _mm_add_ps(_mm_set1_ps(y + 0.5f), laneY);
+        __m128 row[3];
+        for (int i = 0; i < 3; ++i) {
+            row[i] = _mm_add_ps(_mm_mul_ps(b[i], py), c[i]);
+        }
+        int rows = setup.maxY - y + 1;
+
+        __m128 px = _mm_add_ps(_mm_set1_ps(setup.minX + 0.5f), laneX);
+        for (int x = setup.minX; x <= setup.maxX; x += BLOCK_WIDTH, px = _mm_add_ps(px, step)) {
+            __m128 w0 = _mm_add_ps(_mm_mul_ps(a[0], px), row[0]);
+            __m128 w1 = _mm_add_ps(_mm_mul_ps(a[1], px), row[1]);
+            __m128 w2 = _mm_add_ps(_mm_mul_ps(a[2], px), row[2]);
+
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)),
+                                       _mm_cmpge_ps(w2, zero));
+            int mask = _mm_movemask_ps(inside) & blockLaneMask(BLOCK_WIDTH, setup.maxX - x + 1, rows);
+            if (mask == 0) {
+                continue;
+            }
+
+            __m128 rejected = _mm_or_ps(_mm_or_ps(_mm_and_ps(_mm_cmpeq_ps(w0, zero), notTopLeft[0]),
+                                                  _mm_and_ps(_mm_cmpeq_ps(w1, zero), notTopLeft[1])),
+                                        _mm_and_ps(_mm_cmpeq_ps(w2, zero), notTopLeft[2]));
+            mask &= ~_mm_movemask_ps(rejected);
+            emitBlock(mask, x, y, BLOCK_WIDTH, fragments);
+        }
+    }
+}
+
+RASTERIZER_TARGET("avx2")
+static void rasterizeTriangleAVX2(const TriangleSetup& setup, std::vector<Fragment>& fragments) {
+    const int BLOCK_WIDTH = 4;
+    const __m256 laneX = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 0.0f, 1.0f, 2.0f, 3.0f);
+    const __m256 laneY = _mm256_setr_ps(0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+    const __m256 step = _mm256_set1_ps(static_cast<float>(BLOCK_WIDTH));
+    const __m256 zero = _mm256_setzero_ps();
+
+    __m256 a[3], b[3], c[3], notTopLeft[3];
+    for (int i = 0; i < 3; ++i) {
+        const EdgeFunction& edge = setup.edges[i];
+        a[i] = _mm256_set1_ps(edge.a);
+        b[i] = _mm256_set1_ps(edge.b);
+        c[i] = _mm256_set1_ps(edge.c);
+        notTopLeft[i] = _mm256_castsi256_ps(_mm256_set1_epi32(edge.isTopLeft() ? 0 : -1));
+    }
+
+    for (int y = setup.minY; y <= setup.maxY; y += 2) {
+        __m256 py = _mm256_add_ps(_mm256_set1_ps(y + 0.5f), laneY);
+        __m256 row[3];
+        for (int i = 0; i < 3; ++i) {
+            row[i] = _mm256_add_ps(_mm256_mul_ps(b[i], py), c[i]);
+        }
+        int rows = setup.maxY - y + 1;
+
+        __m256 px = _mm256_add_ps(_mm256_set1_ps(setup.minX + 0.5f), laneX);
+        for (int x = setup.minX; x <= setup.maxX; x += BLOCK_WIDTH, px = _mm256_add_ps(px, step)) {
+            __m256 w0 = _mm256_add_ps(_mm256_mul_ps(a[0], px), row[0]);
+            __m256 w1 = _mm256_add_ps(_mm256_mul_ps(a[1], px), row[1]);
+            __m256 w2 = _mm256_add_ps(_mm256_mul_ps(a[2], px), row[2]);
+
+            __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(w0, zero, _CMP_GE_OQ),
+                                                        _mm256_cmp_ps(w1, zero, _CMP_GE_OQ)),
+                                          _mm256_cmp_ps(w2, zero, _CMP_GE_OQ));
+            int mask = _mm256_movemask_ps(inside) & blockLaneMask(BLOCK_WIDTH, setup.maxX - x + 1, rows);
+            if (mask == 0) {
+                continue;
+            }
+
+            __m256 rejected = _mm256_or_ps(
+                _mm256_or_ps(_mm256_and_ps(_mm256_cmp_ps(w0, zero, _CMP_EQ_OQ), notTopLeft[0]),
+                             _mm256_and_ps(_mm256_cmp_ps(w1, zero, _CMP_EQ_OQ), notTopLeft[1])),
+                _mm256_and_ps(_mm256_cmp_ps(w2, zero, _CMP_EQ_OQ), notTopLeft[2]));
+            mask &= ~_mm256_movemask_ps(rejected);
+            emitBlock(mask, x, y, BLOCK_WIDTH, fragments);
+        }
+    }
+}
+
+RASTERIZER_TARGET("avx512f")
+static void rasterizeTriangleAVX512(const TriangleSetup& setup, std::vector<Fragment>& fragments) {
+    const int BLOCK_WIDTH = 8;
+    const __m512 laneX = _mm512_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f,
+                                        0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m512 laneY = _mm512_setr_ps(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+                                        1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+    const __m512 step = _mm512_set1_ps(static_cast<float>(BLOCK_WIDTH));
+    const __m512 zero = _mm512_setzero_ps();
+
+    __m512 a[3], b[3], c[3];
+    __mmask16 notTopLeft[3];
+    for (int i = 0; i < 3; ++i) {
+        const EdgeFunction& edge = setup.edges[i];
+        a[i] = _mm512_set1_ps(edge.a);
+        b[i] = _mm512_set1_ps(edge.b);
+        c[i] = _mm512_set1_ps(edge.c);
+        notTopLeft[i] = edge.isTopLeft() ? 0 : 0xFFFF;
+    }
+
+    for (int y = setup.minY; y <= setup.maxY; y += 2) {
+        __m512 py = _mm512_add_ps(_mm512_set1_ps(y + 0.5f), laneY);
+        __m512 row[3];
+        for (int i = 0; i < 3; ++i) {
+            row[i] = _mm512_add_ps(_mm512_mul_ps(b[i], py), c[i]);
+        }
+        int rows = setup.maxY - y + 1;
+
+        __m512 px = _mm512_add_ps(_mm512_set1_ps(setup.minX + 0.5f), laneX);
+        for (int x = setup.minX; x <= setup.maxX; x += BLOCK_WIDTH, px = _mm512_add_ps(px, step)) {
+            __m512 w0 = _mm512_add_ps(_mm512_mul_ps(a[0], px), row[0]);
+            __m512 w1 = _mm512_add_ps(_mm512_mul_ps(a[1], px), row[1]);
+            __m512 w2 = _mm512_add_ps(_mm512_mul_ps(a[2], px), row[2]);
+
+            // Later compares only test the lanes still set in the mask
+            __mmask16 mask = static_cast<__mmask16>(blockLaneMask(BLOCK_WIDTH, setup.maxX - x + 1, rows));
+            mask = _mm512_mask_cmp_ps_mask(mask, w0, zero, _CMP_GE_OQ);
+            mask = _mm512_mask_cmp_ps_mask(mask, w1, zero, _CMP_GE_OQ);
+            mask = _mm512_mask_cmp_ps_mask(mask, w2, zero, _CMP_GE_OQ);
+            if (mask == 0) {
+                continue;
+            }
+
+            __mmask16 rejected = _mm512_mask_cmp_ps_mask(notTopLeft[0], w0, zero, _CMP_EQ_OQ) |
+                                 _mm512_mask_cmp_ps_mask(notTopLeft[1], w1, zero, _CMP_EQ_OQ) |
+                                 _mm512_mask_cmp_ps_mask(notTopLeft[2], w2, zero, _CMP_EQ_OQ);
+            emitBlock(mask & ~rejected, x, y, BLOCK_WIDTH, fragments);
+        }
+    }
+}
+
+// Fixed-point kernels, over the same blocks as the float ones. Edge values are kept relative to
+// the first pixel of the bounding box in 32-bit lanes, stepped by exact integer adds; callers
+// check with fitsInt32 that no value overflows. The fill rule is folded into c, so a lane is
+// covered when the sign bits of all three values are clear, which one OR of the three tests at once.
+
+// Edge value at the first pixel center of the bounding box, and its steps per pixel in x and y
+struct FixedEdgeStart {
+    int32_t value;
+    int32_t stepX;
+    int32_t stepY;
+};
+
+static std::array<FixedEdgeStart, 3> fixedEdgeStarts(const TriangleSetup& setup) {
+    const int64_t half = int64_t(1) << (setup.subpixelBits - 1);
+    int64_t px = (int64_t(setup.minX) << setup.subpixelBits) + half;
+    int64_t py = (int64_t(setup.minY) << setup.subpixelBits) + half;
+
+    std::array<FixedEdgeStart, 3> starts;
+    for (int i = 0; i < 3; ++i) {
+        const FixedEdgeFunction& edge = setup.fixedEdges[i];
+        starts[i] = {static_cast<int32_t>(edge.evaluate(px, py)), static_cast<int32_t>(edge.a << setup.subpixelBits),
+                     static_cast<int32_t>(edge.b << setup.subpixelBits)};
+    }
+    return starts;
+}
+
+// Edge value at the first pixel center of a row of the bounding box. fitsInt32 only bounds the
+// values themselves, so the product is taken in 64 bits and narrowed once.
+static int32_t fixedRowStart(const FixedEdgeStart& start, int row) {
+    return static_cast<int32_t>(start.value + int64_t(row) * start.stepY);
+}
+
+// Edge step from one block of a row to the next. Like the row starts, it can leave the 32-bit
+// range on a long edge even though every value stepped through fits; wrapping it is exact, since
+// the lanes add modulo 2^32.
+static int32_t fixedBlockStep(const FixedEdgeStart& start, int blockWidth) {
+    return static_cast<int32_t>(int64_t(start.stepX) * blockWidth);
+}
+
+RASTERIZER_TARGET("sse4.1")
+static void rasterizeTriangleFixedSSE41(const TriangleSetup& setup, std::vector<Fragment>& fragments) {
+    const int BLOCK_WIDTH = 2;
+    const __m128i laneX = _mm_setr_epi32(0, 1, 0, 1);
+    const __m128i laneY = _mm_setr_epi32(0, 0, 1, 1);
+    std::array<FixedEdgeStart, 3> starts = fixedEdgeStarts(setup);
+
+    __m128i laneOffset[3], blockStep[3];
+    for (int i = 0; i < 3; ++i) {
+        laneOffset[i] = _mm_add_epi32(_mm_mullo_epi32(laneX, _mm_set1_epi32(starts[i].stepX)),
+                                      _mm_mullo_epi32(laneY, _mm_set1_epi32(starts[i].stepY)));
+        blockStep[i] = _mm_set1_epi32(fixedBlockStep(starts[i], BLOCK_WIDTH));
+    }
+
+    for (int y = setup.minY; y <= setup.maxY; y += 2) {
+        __m128i w[3];
+        for (int i = 0; i < 3; ++i) {
+            int32_t rowStart = fixedRowStart(starts[i], y - setup.minY);
+            w[i] = _mm_add_epi32(_mm_set1_epi32(rowStart), laneOffset[i]);
+        }
+        int rows = setup.maxY - y + 1;
+
+        for (int x = setup.minX; x <= setup.maxX; x += BLOCK_WIDTH) {
+            __m128i negative = _mm_or_si128(_mm_or_si128(w[0], w[1]), w[2]);
+            int mask = ~_mm_movemask_ps(_mm_castsi128_ps(negative)) &
+                       blockLaneMask(BLOCK_WIDTH, setup.maxX - x + 1, rows);
+            emitBlock(mask, x, y, BLOCK_WIDTH, fragments);
+            for (int i = 0; i < 3; ++i) {
+                w[i] = _mm_add_epi32(w[i], blockStep[i]);
+            }
+        }
+    }
+}
+
+RASTERIZER_TARGET("avx2")
+static void rasterizeTriangleFixedAVX2(const TriangleSetup& setup, std::vector<Fragment>& fragments) {
+    const int BLOCK_WIDTH = 4;
+    const __m256i laneX = _mm256_setr_epi32(0, 1, 2, 3, 0, 1, 2, 3);
+    const __m256i laneY = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+    std::array<FixedEdgeStart, 3> starts = fixedEdgeStarts(setup);
+
+    __m256i laneOffset[3], blockStep[3];
+    for (int i = 0; i < 3; ++i) {
+        laneOffset[i] = _mm256_add_epi32(_mm256_mullo_epi32(laneX, _mm256_set1_epi32(starts[i].stepX)),
+                                         _mm256_mullo_epi32(laneY, _mm256_set1_epi32(starts[i].stepY)));
+        blockStep[i] = _mm256_set1_epi32(fixedBlockStep(starts[i], BLOCK_WIDTH));
+    }
+
+    for (int y = setup.minY; y <= setup.maxY; y += 2) {
+        __m256i w[3];
+        for (int i = 0; i < 3; ++i) {
+            int32_t rowStart = fixedRowStart(starts[i], y - setup.minY);
+            w[i] = _mm256_add_epi32(_mm256_set1_epi32(rowStart), laneOffset[i]);
+        }
+        int rows = setup.maxY - y + 1;
+
+        for (int x = setup.minX; x <= setup.maxX; x += BLOCK_WIDTH) {
+            __m256i negative = _mm256_or_si256(_mm256_or_si256(w[0], w[1]), w[2]);
+            int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(negative)) &
+                       blockLaneMask(BLOCK_WIDTH, setup.maxX - x + 1, rows);
+            emitBlock(mask, x, y, BLOCK_WIDTH, fragments);
+            for (int i = 0; i < 3; ++i) {
+                w[i] = _mm256_add_epi32(w[i], blockStep[i]);
+            }
+        }
+    }
+}
+
+RASTERIZER_TARGET("avx512f")
+static void rasterizeTriangleFixedAVX512(const TriangleSetup& setup, std::vector<Fragment>& fragments) {
+    const int BLOCK_WIDTH = 8;
+    const __m512i laneX = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7);
+    const __m512i laneY = _mm512_setr_epi32(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+    const __m512i zero = _mm512_setzero_si512();
+    std::array<FixedEdgeStart, 3> starts = fixedEdgeStarts(setup);
+
+    __m512i laneOffset[3], blockStep[3];
+    for (int i = 0; i < 3; ++i) {
+        laneOffset[i] = _mm512_add_epi32(_mm512_mullo_epi32(laneX, _mm512_set1_epi32(starts[i].stepX)),
+                                         _mm512_mullo_epi32(laneY, _mm512_set1_epi32(starts[i].stepY)));
+        blockStep[i] = _mm512_set1_epi32(fixedBlockStep(starts[i], BLOCK_WIDTH));
+    }
+
+    for (int y = setup.minY; y <= setup.maxY; y += 2) {
+        __m512i w[3];
+        for (int i = 0; i < 3; ++i) {
+            int32_t rowStart = fixedRowStart(starts[i], y - setup.minY);
+            w[i] = _mm512_add_epi32(_mm512_set1_epi32(rowStart), laneOffset[i]);
+        }
+        int rows = setup.maxY - y + 1;
+
+        for (int x = setup.minX; x <= setup.maxX; x += BLOCK_WIDTH) {
+            __m512i negative = _mm512_or_si512(_mm512_or_si512(w[0], w[1]), w[2]);
+            __mmask16 mask = _mm512_mask_cmpge_epi32_mask(
+                static_cast<__mmask16>(blockLaneMask(BLOCK_WIDTH, setup.maxX - x + 1, rows)), negative, zero);
+            emitBlock(mask, x, y, BLOCK_WIDTH, fragments);
+            for (int i = 0; i < 3; ++i) {
+                w[i] = _mm512_add_epi32(w[i], blockStep[i]);
+            }
+        }
+    }
+}
+
+#else
+
+static SimdLevel detectCpuSimdLevel() {
+    return SimdLevel::Scalar;
+}
+
+#endif
+
+SimdLevel detectSimdLevel() {
+    static const SimdLevel level = detectCpuSimdLevel();
+    return level;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SSE41:
+            return "SSE4.1";
+        case SimdLevel::AVX2:
+            return "AVX2";
+        case SimdLevel::AVX512:
+            return "AVX-512";
+        default:
+            return "scalar";
+    }
+}
+
+// Scalar fixed-point kernel. Integer adds are exact, so the edge values are stepped along the
+// row instead of evaluated per pixel.
+static void rasterizeTriangleFixed(const TriangleSetup& setup, std::vector<Fragment>& fragments) {
+    const FixedEdgeFunction& e0 = setup.fixedEdges[0];
+    const FixedEdgeFunction& e1 = setup.fixedEdges[1];
+    const FixedEdgeFunction& e2 = setup.fixedEdges[2];
+    const int64_t half = int64_t(1) << (setup.subpixelBits - 1);
+    const int64_t step0 = e0.a << setup.subpixelBits;
+    const int64_t step1 = e1.a << setup.subpixelBits;
+    const int64_t step2 = e2.a << setup.subpixelBits;
+
+    for (int y = setup.minY; y <= setup.maxY; ++y) {
+        int64_t px = (int64_t(setup.minX) << setup.subpixelBits) + half;
+        int64_t py = (int64_t(y) << setup.subpixelBits) + half;
+        int64_t w0 = e0.evaluate(px, py);
+        int64_t w1 = e1.evaluate(px, py);
+        int64_t w2 = e2.evaluate(px, py);
+
+        for (int x = setup.minX; x <= setup.maxX; ++x) {
+            if ((w0 | w1 | w2) >= 0) {
+                fragments.push_back(Fragment(x, y));
+            }
+            w0 += step0;
+            w1 += step1;
+            w2 += step2;
+        }
+    }
+}
+
+// Whether the edge values the SIMD fixed-point kernels step through fit in 32 bits. Blocks
+// reach up to 8 pixels past the right of the bounding box and one row below it, and the edge
+// functions are linear, so the extremes are at the corners of that enlarged box.
+static bool fitsInt32(const TriangleSetup& setup) {
+    const int64_t half = int64_t(1) << (setup.subpixelBits - 1);
+    int64_t left = (int64_t(setup.minX) << setup.subpixelBits) + half;
+    int64_t right = (int64_t(setup.maxX + 8) << setup.subpixelBits) + half;
+    int64_t top = (int64_t(setup.minY) << setup.subpixelBits) + half;
+    int64_t bottom = (int64_t(setup.maxY + 1) << setup.subpixelBits) + half;
+
+    for (const FixedEdgeFunction& edge : setup.fixedEdges) {
+        for (int64_t value : {edge.evaluate(left, top), edge.evaluate(right, top), edge.evaluate(left, bottom),
+                              edge.evaluate(right, bottom)}) {
+            if (value < INT32_MIN || value > INT32_MAX) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void rasterizeTriangle(const TriangleSetup& setup, SimdLevel level, std::vector<Fragment>& fragments) {
+    if (setup.subpixelBits > 0) {
+        // Far-reaching edges on a large bounding box take the 64-bit scalar kernel
+        if (level != SimdLevel::Scalar && !fitsInt32(setup)) {
+            level = SimdLevel::Scalar;
+        }
+        switch (level) {
+#ifdef RASTERIZER_X86
+            case SimdLevel::SSE41:
+                rasterizeTriangleFixedSSE41(setup, fragments);
+                return;
+            case SimdLevel::AVX2:
+                rasterizeTriangleFixedAVX2(setup, fragments);
+                return;
+            case SimdLevel::AVX512:
+                rasterizeTriangleFixedAVX512(setup, fragments);
+                return;
+#endif
+            default:
+                rasterizeTriangleFixed(setup, fragments);
+                return;
+        }
+    }
+
+    switch (level) {
+#ifdef RASTERIZER_X86
+        case SimdLevel::SSE41:
+            rasterizeTriangleSSE41(setup, fragments);
+            return;
+        case SimdLevel::AVX2:
+            rasterizeTriangleAVX2(setup, fragments);
+            return;
+        case SimdLevel::AVX512:
+            rasterizeTriangleAVX512(setup, fragments);
+            return;
+#endif
+        default:
+            triangle(setup, fragments);
+            return;
+    }
+}
+
+TileBins binTriangles(const std::vector<TriangleSetup>& setups, const Scissor& scissor) {
+    TileBins bins;
+    bins.tilesX = (scissor.x + scissor.width + TILE_SIZE - 1) / TILE_SIZE;
+    bins.tilesY = (scissor.y + scissor.height + TILE_SIZE - 1) / TILE_SIZE;
+    bins.triangles.resize(static_cast<size_t>(bins.tilesX) * bins.tilesY);
+
+    // Bounding boxes are already clamped to the scissor rectangle, so they never leave the grid
+    for (size_t i = 0; i < setups.size(); ++i) {
+        const TriangleSetup& setup = setups[i];
+        for (int tileY = setup.minY / TILE_SIZE; tileY <= setup.maxY / TILE_SIZE; ++tileY) {
+            for (int tileX = setup.minX / TILE_SIZE; tileX <= setup.maxX / TILE_SIZE; ++tileX) {
+                bins.triangles[tileY * bins.tilesX + tileX].push_back(static_cast<uint32_t>(i));
+            }
+        }
+    }
+
+    return bins;
+}
+
+void DepthBuffer::resize(int tilesX, int tilesY) {
+    this->tilesX = tilesX;
+    this->tilesY = tilesY;
+    size_t tiles = static_cast<size_t>(tilesX) * tilesY;
+    values.resize(tiles * TILE_SIZE * TILE_SIZE);
+    blockMin.resize(tiles * TILE_BLOCKS * TILE_BLOCKS);
+    blockMax.resize(tiles * TILE_BLOCKS * TILE_BLOCKS);
+    staleBlocks.resize(tiles);
+}
+
+// Rounding error bound of an edge function evaluated anywhere in the pixel rectangle: every
+// evaluation of a * px + (b * py + c) is within this of the exact value
+static float evaluationError(const EdgeFunction& edge, int minX, int minY, int maxX, int maxY) {
+    float extentX = std::max(std::abs(minX + 0.5f), std::abs(maxX + 0.5f));
+    float extentY = std::max(std::abs(minY + 0.5f), std::abs(maxY + 0.5f));
+    float magnitude = std::abs(edge.a) * extentX + std::abs(edge.b) * extentY + std::abs(edge.c);
+    return 2.0f * std::numeric_limits<float>::epsilon() * magnitude;
+}
+
+enum class BlockCoverage {
+    Outside,
+    Partial,
+    Inside
+};
+
+// Float edges: the corners have to clear the rounding error of an evaluation twice over, so
+// the decision always agrees with what the per-pixel test would find
+static BlockCoverage classifyBlock(const TriangleSetup& setup, const float margin[3], int minX, int minY, int maxX,
+                                   int maxY) {
+    float left = minX + 0.5f;
+    float right = maxX + 0.5f;
+    float top = minY + 0.5f;
+    float bottom = maxY + 0.5f;
+
+    BlockCoverage coverage = BlockCoverage::Inside;
+    for (int i = 0; i < 3; ++i) {
+        const EdgeFunction& edge = setup.edges[i];
+        float topRow = edge.b * top + edge.c;
+        float bottomRow = edge.b * bottom + edge.c;
+        float w00 = edge.a * left + topRow;
+        float w10 = edge.a * right + topRow;
+        float w01 = edge.a * left + bottomRow;
+        float w11 = edge.a * right + bottomRow;
+        if (std::max(std::max(w00, w10), std::max(w01, w11)) <= -margin[i]) {
+            return BlockCoverage::Outside;
+        }
+        if (std::min(std::min(w00, w10), std::min(w01, w11)) < margin[i]) {
+            coverage = BlockCoverage::Partial;
+        }
+    }
+    return coverage;
+}
+
+// Fixed-point edges are exact and already include the fill rule: no margin needed
+static BlockCoverage classifyBlockFixed(const TriangleSetup& setup, int minX, int minY, int maxX, int maxY) {
+    const int64_t half = int64_t(1) << (setup.subpixelBits - 1);
+    int64_t left = (int64_t(minX) << setup.subpixelBits) + half;
+    int64_t right = (int64_t(maxX) << setup.subpixelBits) + half;
+    int64_t top = (int64_t(minY) << setup.subpixelBits) + half;
+    int64_t bottom = (int64_t(maxY) << setup.subpixelBits) + half;
+
+    BlockCoverage coverage = BlockCoverage::Inside;
+    for (const FixedEdgeFunction& edge : setup.fixedEdges) {
+        int64_t w00 = edge.evaluate(left, top);
+        int64_t w10 = edge.evaluate(right, top);
+        int64_t w01 = edge.evaluate(left, bottom);
+        int64_t w11 = edge.evaluate(right, bottom);
+        if (std::max(std::max(w00, w10), std::max(w01, w11)) < 0) {
+            return BlockCoverage::Outside;
+        }
+        if (std::min(std::min(w00, w10), std::min(w01, w11)) < 0) {
+            coverage = BlockCoverage::Partial;
+        }
+    }
+    return coverage;
+}
+
+// Coarse level of the hierarchy: walks the bounding box in HIERARCHY_BLOCK_SIZE blocks and
+// evaluates the edge functions at the block's corner pixels. An edge function is linear, so its
+// values at the pixels in between lie between the corner values. A block where one edge is
+// negative at all four corners is skipped; a block where every edge is positive at all four is
+// emitted without testing its pixels. Blocks that are neither go to the SIMD kernel, which
+// tests them a 2x2 (or wider) block at a time and skips the small blocks with no coverage.
+// occludedBlocks has the bits, numbered as in DepthBuffer::staleBlocks, of the blocks of the tile
+// at (tileMinX, tileMinY) that Hi-Z proved hidden: they are skipped like blocks outside the triangle
+static void rasterizeBlocks(const TriangleSetup& setup, SimdLevel level, uint64_t occludedBlocks, int tileMinX,
+                            int tileMinY, std::vector<Fragment>& fragments, RenderStats& stats) {
+    float margin[3];
+    for (int i = 0; i < 3; ++i) {
+        margin[i] = 2.0f * evaluationError(setup.edges[i], setup.minX, setup.minY, setup.maxX, setup.maxY);
+    }
+
+    // Consecutive partial blocks of a block row are passed to the kernel as one run
+    TriangleSetup run = setup;
+    auto flushRun = [&](int endX) {
+        if (run.minX <= endX) {
+            run.maxX = endX;
+            rasterizeTriangle(run, level, fragments);
+        }
+    };
+
+    int firstBlockX = setup.minX & ~(HIERARCHY_BLOCK_SIZE - 1);
+    int firstBlockY = setup.minY & ~(HIERARCHY_BLOCK_SIZE - 1);
+    for (int blockY = firstBlockY; blockY <= setup.maxY; blockY += HIERARCHY_BLOCK_SIZE) {
+        int minY = std::max(blockY, setup.minY);
+        int maxY = std::min(blockY + HIERARCHY_BLOCK_SIZE - 1, setup.maxY);
+        run.minY = minY;
+        run.maxY = maxY;
+        run.minX = setup.minX;
+
+        for (int blockX = firstBlockX; blockX <= setup.maxX; blockX += HIERARCHY_BLOCK_SIZE) {
+            int minX = std::max(blockX, setup.minX);
+            int maxX = std::min(blockX + HIERARCHY_BLOCK_SIZE - 1, setup.maxX);
+
+            int block = (blockY - tileMinY) / HIERARCHY_BLOCK_SIZE * TILE_BLOCKS + (blockX - tileMinX) / HIERARCHY_BLOCK_SIZE;
+            BlockCoverage coverage;
+            if ((occludedBlocks >> block) & 1) {
+                coverage = BlockCoverage::Outside;
+            } else if (setup.subpixelBits > 0) {
+                coverage = classifyBlockFixed(setup, minX, minY, maxX, maxY);
+            } else {
+                coverage = classifyBlock(setup, margin, minX, minY, maxX, maxY);
+            }
+            if (coverage == BlockCoverage::Partial) {
+                continue;
+            }
+
+            flushRun(minX - 1);
+            run.minX = maxX + 1;
+            if (coverage == BlockCoverage::Inside) {
+                int width = maxX - minX + 1;
+                size_t first = fragments.size();
+                fragments.resize(first + static_cast<size_t>(width) * (maxY - minY + 1));
+                Fragment* fragment = &fragments[first];
+                for (int y = minY; y <= maxY; ++y) {
+                    for (int x = minX; x <= maxX; ++x) {
+                        *fragment++ = Fragment(x, y);
+                    }
+                }
+                stats.acceptedBlockPixels += fragments.size() - first;
+            }
+        }
+        flushRun(setup.maxX);
+    }
+}
+
+template <CompareOp op>
+static bool depthPasses(float depth, float stored) {
+    switch (op) {
+    case CompareOp::Never: return false;
+    case CompareOp::Less: return depth < stored;
+    case CompareOp::LessEqual: return depth <= stored;
+    case CompareOp::Equal: return depth == stored;
+    case CompareOp::Greater: return depth > stored;
+    case CompareOp::GreaterEqual: return depth >= stored;
+    case CompareOp::NotEqual: return depth != stored;
+    case CompareOp::Always: return true;
+    }
+    return true;
+}
+
+// Interpolates the depth of fragments [first, end) of one triangle and compacts those that pass
+// the test against the tile's depth in place. Instantiated per compare op so the loop does not
+// branch on it.
+template <CompareOp op>
+static void depthTest(const TriangleSetup& setup, bool depthWrite, int tileMinX, int tileMinY, float* tileDepth,
+                      std::vector<Fragment>& fragments, size_t first) {
+    const EdgeFunction& plane = setup.depthPlane;
+    size_t kept = first;
+    for (size_t i = first; i < fragments.size(); ++i) {
+        Fragment fragment = fragments[i];
+        fragment.depth = plane.evaluate(fragment.position.x + 0.5f, fragment.position.y + 0.5f);
+        float& stored = tileDepth[(fragment.position.y - tileMinY) * TILE_SIZE + (fragment.position.x - tileMinX)];
+        if (depthPasses<op>(fragment.depth, stored)) {
+            if (depthWrite) {
+                stored = fragment.depth;
+            }
+            fragments[kept++] = fragment;
+        }
+    }
+    fragments.resize(kept);
+}
+
+static void depthTest(const TriangleSetup& setup, CompareOp op, bool depthWrite, int tileMinX, int tileMinY,
+                      float* tileDepth, std::vector<Fragment>& fragments, size_t first) {
+    switch (op) {
+    case CompareOp::Never:
+        depthTest<CompareOp::Never>(setup, depthWrite, tileMinX, tileMinY, tileDepth, fragments, first);
+        break;
+    case CompareOp::Less:
+        depthTest<CompareOp::Less>(setup, depthWrite, tileMinX, tileMinY, tileDepth, fragments, first);
+        break;
+    case CompareOp::LessEqual:
+        depthTest<CompareOp::LessEqual>(setup, depthWrite, tileMinX, tileMinY, tileDepth, fragments, first);
+        break;
+    case CompareOp::Equal:
+        depthTest<CompareOp::Equal>(setup, depthWrite, tileMinX, tileMinY, tileDepth, fragments, first);
+        break;
+    case CompareOp::Greater:
+        depthTest<CompareOp::Greater>(setup, depthWrite, tileMinX, tileMinY, tileDepth, fragments, first);
+        break;
+    case CompareOp::GreaterEqual:
+        depthTest<CompareOp::GreaterEqual>(setup, depthWrite, tileMinX, tileMinY, tileDepth, fragments, first);
+        break;
+    case CompareOp::NotEqual:
+        depthTest<CompareOp::NotEqual>(setup, depthWrite, tileMinX, tileMinY, tileDepth, fragments, first);
+        break;
+    case CompareOp::Always:
+        depthTest<CompareOp::Always>(setup, depthWrite, tileMinX, tileMinY, tileDepth, fragments, first);
+        break;
+    }
+}
+
+// True when no depth in [minDepth, maxDepth] can pass op against any stored depth in
+// [storedMin, storedMax]
+static bool depthRangeFails(CompareOp op, float minDepth, float maxDepth, float storedMin, float storedMax) {
+    switch (op) {
+    case CompareOp::Never: return true;
+    case CompareOp::Less: return minDepth >= storedMax;
+    case CompareOp::LessEqual: return minDepth > storedMax;
+    case CompareOp::Equal: return maxDepth < storedMin || minDepth > storedMax;
+    case CompareOp::Greater: return maxDepth <= storedMin;
+    case CompareOp::GreaterEqual: return maxDepth < storedMin;
+    case CompareOp::NotEqual: return false;
+    case CompareOp::Always: return false;
+    }
+    return false;
+}
+
+// Blocks of the tile that the rectangle [minX, maxX] x [minY, maxY], inside the tile, overlaps
+static uint64_t overlappedBlocks(int minX, int minY, int maxX, int maxY, int tileMinX, int tileMinY) {
+    uint64_t mask = 0;
+    for (int by = (minY - tileMinY) / HIERARCHY_BLOCK_SIZE; by <= (maxY - tileMinY) / HIERARCHY_BLOCK_SIZE; ++by) {
+        for (int bx = (minX - tileMinX) / HIERARCHY_BLOCK_SIZE; bx <= (maxX - tileMinX) / HIERARCHY_BLOCK_SIZE; ++bx) {
+            mask |= uint64_t(1) << (by * TILE_BLOCKS + bx);
+        }
+    }
+    return mask;
+}
+
+// Hi-Z test of a triangle clamped to a tile: returns the overlapped blocks in which every fragment
+// it could produce fails the depth test. The triangle's depth over each block is bounded by the
+// depth plane at the corners of the part of its bounding box inside the block, widened by twice
+// the plane's rounding error since fragments evaluate it per pixel. Stale block bounds are
+// recomputed first.
+static uint64_t occludedBlocks(const TriangleSetup& setup, CompareOp op, uint64_t overlapped, int tileMinX,
+                               int tileMinY, const float* tileDepth, float* blockMin, float* blockMax,
+                               uint64_t& staleBlocks) {
+    const EdgeFunction& plane = setup.depthPlane;
+    float margin = 2.0f * evaluationError(plane, setup.minX, setup.minY, setup.maxX, setup.maxY);
+
+    uint64_t occluded = 0;
+    for (uint64_t remaining = overlapped; remaining != 0; remaining &= remaining - 1) {
+        int block = std::countr_zero(remaining);
+        int blockX = tileMinX + block % TILE_BLOCKS * HIERARCHY_BLOCK_SIZE;
+        int blockY = tileMinY + block / TILE_BLOCKS * HIERARCHY_BLOCK_SIZE;
+
+        if ((staleBlocks >> block) & 1) {
+            const float* row = tileDepth + (blockY - tileMinY) * TILE_SIZE + (blockX - tileMinX);
+            float low = row[0];
+            float high = row[0];
+            for (int y = 0; y < HIERARCHY_BLOCK_SIZE; ++y, row += TILE_SIZE) {
+                for (int x = 0; x < HIERARCHY_BLOCK_SIZE; ++x) {
+                    low = std::min(low, row[x]);
+                    high = std::max(high, row[x]);
+                }
+            }
+            blockMin[block] = low;
+            blockMax[block] = high;
+        }
+
+        float x0 = std::max(blockX, setup.minX) + 0.5f;
+        float y0 = std::max(blockY, setup.minY) + 0.5f;
+        float x1 = std::min(blockX + HIERARCHY_BLOCK_SIZE - 1, setup.maxX) + 0.5f;
+        float y1 = std::min(blockY + HIERARCHY_BLOCK_SIZE - 1, setup.maxY) + 0.5f;
+        float z00 = plane.evaluate(x0, y0);
+        float z10 = plane.evaluate(x1, y0);
+        float z01 = plane.evaluate(x0, y1);
+        float z11 = plane.evaluate(x1, y1);
+        float minDepth = std::min(std::min(z00, z10), std::min(z01, z11)) - margin;
+        float maxDepth = std::max(std::max(z00, z10), std::max(z01, z11)) + margin;
+        if (depthRangeFails(op, minDepth, maxDepth, blockMin[block], blockMax[block])) {
+            occluded |= uint64_t(1) << block;
+        }
+    }
+    staleBlocks &= ~overlapped;
+
+    return occluded;
+}
+
+void rasterizeTile(const std::vector<TriangleSetup>& setups, const TileBins& bins, size_t tile,
+                   const PipelineState& state, DepthBuffer& depthBuffer, const FragmentSink& sink,
+                   std::vector<Fragment>& scratch, RenderStats& stats) {
+    std::vector<Fragment>& fragments = scratch;
+    fragments.clear();
+    int tileMinX = static_cast<int>(tile % bins.tilesX) * TILE_SIZE;
+    int tileMinY = static_cast<int>(tile / bins.tilesX) * TILE_SIZE;
+
+    // Each tile clears its own depth, on the thread that rasterizes it and while it is in cache
+    float* tileDepth = depthBuffer.tile(tile);
+    float* blockMin = &depthBuffer.blockMin[tile * TILE_BLOCKS * TILE_BLOCKS];
+    float* blockMax = &depthBuffer.blockMax[tile * TILE_BLOCKS * TILE_BLOCKS];
+    uint64_t& staleBlocks = depthBuffer.staleBlocks[tile];
+    if (state.depthTest) {
+        std::fill(tileDepth, tileDepth + TILE_SIZE * TILE_SIZE, state.clearDepth);
+        std::fill(blockMin, blockMin + TILE_BLOCKS * TILE_BLOCKS, state.clearDepth);
+        std::fill(blockMax, blockMax + TILE_BLOCKS * TILE_BLOCKS, state.clearDepth);
+        staleBlocks = 0;
+    }
+    // Without depth testing fragments still get their depth, but the buffer is left alone
+    CompareOp depthCompare = state.depthTest ? state.depthCompare : CompareOp::Always;
+    bool depthWrite = state.depthTest && state.depthWrite;
+
+    // Coverage is computed per pixel, so clamping the bounding box does not change which
+    // pixels a triangle covers
+    for (uint32_t i : bins.triangles[tile]) {
+        TriangleSetup setup = setups[i];
+        setup.minX = std::max(setup.minX, tileMinX);
+        setup.minY = std::max(setup.minY, tileMinY);
+        setup.maxX = std::min(setup.maxX, tileMinX + TILE_SIZE - 1);
+        setup.maxY = std::min(setup.maxY, tileMinY + TILE_SIZE - 1);
+
+        // Hi-Z: a triangle hidden in every block it overlaps is dropped before any per-pixel work
+        uint64_t overlapped = overlappedBlocks(setup.minX, setup.minY, setup.maxX, setup.maxY, tileMinX, tileMinY);
+        uint64_t occluded = 0;
+        if (state.depthTest) {
+            occluded = occludedBlocks(setup, depthCompare, overlapped, tileMinX, tileMinY, tileDepth, blockMin,
+                                      blockMax, staleBlocks);
+            if (occluded != 0) {
+                for (uint64_t remaining = occluded; remaining != 0; remaining &= remaining - 1) {
+                    int block = std::countr_zero(remaining);
+                    int blockX = tileMinX + block % TILE_BLOCKS * HIERARCHY_BLOCK_SIZE;
+                    int blockY = tileMinY + block / TILE_BLOCKS * HIERARCHY_BLOCK_SIZE;
+                    int width = std::min(blockX + HIERARCHY_BLOCK_SIZE - 1, setup.maxX) - std::max(blockX, setup.minX) + 1;
+                    int height = std::min(blockY + HIERARCHY_BLOCK_SIZE - 1, setup.maxY) - std::max(blockY, setup.minY) + 1;
+                    stats.hiZRejectedPixels += static_cast<size_t>(width) * height;
+                }
+                if (occluded == overlapped) {
+                    continue;
+                }
+            }
+        }
+
+        // Triangles less than two blocks across rarely cover a whole aligned block, the corner
+        // tests would cost more than they save: they go straight to the SIMD kernel, unless some
+        // of their blocks are hidden
+        size_t firstTriangleFragment = fragments.size();
+        int width = setup.maxX - setup.minX + 1;
+        int height = setup.maxY - setup.minY + 1;
+        if (occluded == 0 && (width <= 2 * HIERARCHY_BLOCK_SIZE || height <= 2 * HIERARCHY_BLOCK_SIZE)) {
+            rasterizeTriangle(setup, state.simdLevel, fragments);
+        } else {
+            rasterizeBlocks(setup, state.simdLevel, occluded, tileMinX, tileMinY, fragments, stats);
+        }
+        stats.coveredPixels += fragments.size() - firstTriangleFragment;
+
+        // Early-Z: each triangle is tested against those before it in submission order, so a
+        // fragment is only spared shading when it is hidden by an earlier triangle
+        depthTest(setup, depthCompare, depthWrite, tileMinX, tileMinY, tileDepth, fragments, firstTriangleFragment);
+        if (depthWrite && fragments.size() > firstTriangleFragment) {
+            staleBlocks |= overlapped;
+        }
+
+        if (fragments.size() >= FRAGMENT_BATCH_SIZE) {
+            stats.shadedFragments += fragments.size();
+            sink(fragments);
+            fragments.clear();
+        }
+    }
+
+    if (!fragments.empty()) {
+        stats.shadedFragments += fragments.size();
+        sink(fragments);
+        fragments.clear();
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "shaders.hpp"
+#include <vector>
+
+// Widest SIMD level both the CPU and the operating system support, detected once
+SimdLevel detectSimdLevel();
+
+// "scalar", "SSE4.1", "AVX2" or "AVX-512"
+const char* simdLevelName(SimdLevel level);
+
+// Rasterizes one triangle a block of pixels at a time, appending the covered pixels to
+// fragments. Coverage is tested with the same edge function evaluation and fill rule as
+// triangle(), so the result only differs from it in the order of the fragments. level must be
+// supported by the CPU; SimdLevel::Scalar forwards to triangle().
+void rasterizeTriangle(const TriangleSetup& setup, SimdLevel level, std::vector<Fragment>& fragments);
+
+// Edge length in pixels of the square screen tiles triangles are binned into. A 64x64 tile
+// holds 16 KB per 4-byte-per-pixel buffer, so its color and depth stay in L1/L2 while it is
+// being rasterized.
+const int TILE_SIZE = 64;
+
+// Sort-middle binning: for every tile of the scissor rectangle's extent, the indices of the
+// triangles whose bounding box overlaps it, in submission order. Tile t covers pixels
+// [t % tilesX, t / tilesX] * TILE_SIZE.
+struct TileBins {
+    int tilesX = 0;
+    int tilesY = 0;
+    std::vector<std::vector<uint32_t>> triangles;
+};
+
+TileBins binTriangles(const std::vector<TriangleSetup>& setups, const Scissor& scissor);
+
+// Edge length of the coarse blocks of the hierarchical rasterizer, which are accepted or
+// rejected whole from the edge functions at their corners. A power of two dividing TILE_SIZE.
+const int HIERARCHY_BLOCK_SIZE = 8;
+
+// Hierarchy blocks along each side of a tile; a tile's blocks fit the bits of a uint64_t
+const int TILE_BLOCKS = TILE_SIZE / HIERARCHY_BLOCK_SIZE;
+static_assert(TILE_BLOCKS * TILE_BLOCKS <= 64);
+
+// Depth of every pixel of the tiles, stored tile by tile: the TILE_SIZE x TILE_SIZE floats of a
+// tile are contiguous, row by row, so a tile's depth stays in cache while it is rasterized.
+// Alongside it, the min and max depth of every hierarchy block (Hi-Z), which lets the rasterizer
+// reject triangles and blocks whose fragments would all fail the depth test. A block's bounds are
+// recomputed from its pixels when they are needed after a write.
+struct DepthBuffer {
+    int tilesX = 0;
+    int tilesY = 0;
+    std::vector<float> values;
+    // TILE_BLOCKS x TILE_BLOCKS per tile, in the same order as the pixels
+    std::vector<float> blockMin;
+    std::vector<float> blockMax;
+    // Per tile, bit by * TILE_BLOCKS + bx is set when block (bx, by) was written since its bounds
+    // were last computed
+    std::vector<uint64_t> staleBlocks;
+
+    void resize(int tilesX, int tilesY);
+
+    float* tile(size_t index) {
+        return values.data() + index * TILE_SIZE * TILE_SIZE;
+    }
+};
+
+// Rasterizes the triangles binned to one tile with their bounding boxes clamped to it. Tiles
+// share no pixels, so they can be rasterized in parallel and in any order. Triangles larger
+// than a block are rasterized hierarchically. With state.depthTest the tile's depth is cleared
+// first, triangles and blocks the Hi-Z bounds prove hidden are skipped, and each triangle's
+// fragments are depth tested as soon as they are rasterized, keeping only those that pass.
+// Fragments are collected in the scratch buffer and passed to sink in batches of
+// FRAGMENT_BATCH_SIZE; scratch is left empty. Adds the tile's covered, trivially accepted,
+// Hi-Z rejected and shaded pixels to stats.
+void rasterizeTile(const std::vector<TriangleSetup>& setups, const TileBins& bins, size_t tile,
+                   const PipelineState& state, DepthBuffer& depthBuffer, const FragmentSink& sink,
+                   std::vector<Fragment>& scratch, RenderStats& stats);
@@ -0,0 +1,116 @@
+#include "renderTarget.hpp"
+#include <SDL.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+WindowTarget::WindowTarget(const char* title, int width, int height) {
+    SDL_Init(SDL_INIT_VIDEO);
+    window = SDL_CreateWindow(title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_SHOWN);
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    // Color's byte order is SDL_PIXELFORMAT_RGBA32, so frames are uploaded without conversion
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, width, height);
+}
+
+WindowTarget::~WindowTarget() {
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+void WindowTarget::present(const Framebuffer& framebuffer) {
+    void* texturePixels;
+    int pitch;
+    if (SDL_LockTexture(texture, nullptr, &texturePixels, &pitch) == 0) {
+        size_t rowBytes = static_cast<size_t>(framebuffer.width) * sizeof(Color);
+        for (int y = 0; y < framebuffer.height; ++y) {
+            std::memcpy(static_cast<uint8_t*>(texturePixels) + static_cast<size_t>(y) * pitch,
+                        &framebuffer.pixels[static_cast<size_t>(y) * framebuffer.width], rowBytes);
+        }
+        SDL_UnlockTexture(texture);
+    }
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+    damaged = false;
+}
+
+void WindowTarget::handleEvent(const SDL_Event& event) {
+    if (event.type == SDL_QUIT) {
+        open = false;
+    } else if (event.type == SDL_WINDOWEVENT && (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                                                 event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)) {
+        damaged = true;
+    }
+}
+
+bool WindowTarget::processEvents(bool wait) {
+    SDL_Event event;
+    // Sleeping in SDL_WaitEvent is what keeps an unchanging window from using any CPU
+    if (wait && SDL_WaitEvent(&event)) {
+        handleEvent(event);
+    }
+    while (SDL_PollEvent(&event)) {
+        handleEvent(event);
+    }
+    return open;
+}
+
+bool WindowTarget::needsPresent() const {
+    return damaged;
+}
+
+void ImageTarget::present(const Framebuffer& framebuffer) {
+    image = framebuffer;
+    ++frameCount;
+}
+
+// Shared by writePPM and PpmFileTarget, which opens its file before rendering starts
+static bool writePPM(std::ofstream& file, const Framebuffer& framebuffer) {
+    file << "P6\n" << framebuffer.width << " " << framebuffer.height << "\n255\n";
+    std::vector<uint8_t> row(static_cast<size_t>(framebuffer.width) * 3);
+    for (int y = 0; y < framebuffer.height; ++y) {
+        const Color* pixel = &framebuffer.pixels[static_cast<size_t>(y) * framebuffer.width];
+        for (int x = 0; x < framebuffer.width; ++x) {
+            row[3 * x] = pixel[x].r;
+            row[3 * x + 1] = pixel[x].g;
+            row[3 * x + 2] = pixel[x].b;
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+    }
+
+    return static_cast<bool>(file);
+}
+
+PpmFileTarget::PpmFileTarget(std::string path) : path(std::move(path)), file(this->path, std::ios::binary) {}
+
+PpmFileTarget::~PpmFileTarget() {
+    // Rendering stopped before finish(): leave no empty image behind, but never remove a device
+    // such as /dev/stdout the output was pointed at
+    if (file.is_open()) {
+        file.close();
+        std::error_code error;
+        if (std::filesystem::is_regular_file(path, error)) {
+            std::filesystem::remove(path, error);
+        }
+    }
+}
+
+bool PpmFileTarget::finish() {
+    if (!file.is_open() || frameCount == 0) {
+        return false;
+    }
+    bool written = writePPM(file, image);
+    file.close();
+    return written && !file.fail();
+}
+
+bool writePPM(const std::string& path, const Framebuffer& framebuffer) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    return writePPM(file, framebuffer);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "shaders.hpp"
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <utility>
+
+struct SDL_Window;
+struct SDL_Renderer;
+struct SDL_Texture;
+union SDL_Event;
+
+// Where finished frames go. The pipeline only ever draws into a Framebuffer, so every stage runs
+// the same whether a frame ends up in a window, in memory or in a file.
+struct RenderTarget {
+    virtual ~RenderTarget() = default;
+
+    // Shows or stores a finished frame
+    virtual void present(const Framebuffer& framebuffer) = 0;
+
+    // Handles pending events, first blocking until one arrives when wait is set. Returns false
+    // once the target has been closed.
+    virtual bool processEvents(bool /*wait*/) {
+        return true;
+    }
+
+    // True when the target lost the last frame presented, e.g. a window that was uncovered or
+    // resized, so it must be presented again even if nothing changed
+    virtual bool needsPresent() const {
+        return false;
+    }
+
+    // Called once when rendering stops, to write out whatever the target still holds. Returns
+    // false when that failed.
+    virtual bool finish() {
+        return true;
+    }
+};
+
+// SDL window showing each frame through a streaming texture: one upload and one copy per frame.
+// SDL video is initialized by the first window and shut down with it.
+struct WindowTarget : RenderTarget {
+    WindowTarget(const char* title, int width, int height);
+    ~WindowTarget() override;
+
+    WindowTarget(const WindowTarget&) = delete;
+    WindowTarget& operator=(const WindowTarget&) = delete;
+
+    void present(const Framebuffer& framebuffer) override;
+    bool processEvents(bool wait) override;
+    bool needsPresent() const override;
+
+private:
+    void handleEvent(const SDL_Event& event);
+
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* texture = nullptr;
+    bool open = true;
+    bool damaged = false;
+};
+
+// Keeps a copy of the last frame in memory, for tests and benchmarks
+struct ImageTarget : RenderTarget {
+    Framebuffer image;
+    size_t frameCount = 0;
+
+    void present(const Framebuffer& framebuffer) override;
+};
+
+// Keeps the last frame in memory like ImageTarget and writes it to a binary PPM file in finish(),
+// so rendering never waits on the disk. The file is created up front, so a path that cannot be
+// written fails before anything is rendered; it is removed again if finish() never runs.
+struct PpmFileTarget : ImageTarget {
+    explicit PpmFileTarget(std::string path);
+    ~PpmFileTarget() override;
+
+    PpmFileTarget(const PpmFileTarget&) = delete;
+    PpmFileTarget& operator=(const PpmFileTarget&) = delete;
+
+    bool isOpen() const {
+        return file.is_open();
+    }
+
+    // Writes the last frame presented; fails if there is none
+    bool finish() override;
+
+private:
+    std::string path;
+    std::ofstream file;
+};
+
+// Writes the framebuffer's RGB channels as a binary (P6) PPM image
+bool writePPM(const std::string& path, const Framebuffer& framebuffer);
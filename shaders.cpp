@@ -1,45 +1,348 @@
 #include "shaders.hpp"
+#include "rasterizer.hpp"
+#include "threadPool.hpp"
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <cmath>
 
-glm::vec3 vertexShader(const glm::vec3& vertex, const Uniforms& uniforms) {
-    // Apply transformations to the input vertex using the matrices from the uniforms
-    glm::vec4 clipSpaceVertex = uniforms.projection * uniforms.view * uniforms.model * glm::vec4(vertex, 1.0f);
-
-    // Perspective divide
-    glm::vec3 ndcVertex = glm::vec3(clipSpaceVertex) / clipSpaceVertex.w;
+glm::vec3 viewportTransform(const glm::vec4& clipSpaceVertex, const Uniforms& uniforms) {
+    // Perspective divide, one division per vertex instead of one per coordinate
+    float inverseW = 1.0f / clipSpaceVertex.w;
+    glm::vec3 ndcVertex = glm::vec3(clipSpaceVertex) * inverseW;
 
     // Apply the viewport transform
-    glm::vec4 screenVertex = uniforms.viewport * glm::vec4(ndcVertex, 1.0f);
+    glm::vec4 screenVertex = uniforms.viewport() * glm::vec4(ndcVertex, 1.0f);
 
     // Return the transformed vertex as a vec3
     return glm::vec3(screenVertex);
 }
 
-std::vector<std::vector<glm::vec3>> primitiveAssembly(
-        const std::vector<glm::vec3>& transformedVertices
+// Clip planes in homogeneous coordinates: a vertex v is inside when dot(plane, v) >= 0.
+// The near plane of an OpenGL-style projection (which glm::perspective builds) is z >= -w.
+static const glm::vec4 NEAR_PLANE(0.0f, 0.0f, 1.0f, 1.0f);
+
+// Planes of a screen rectangle, expressed in clip space through the (affine) viewport matrix:
+// screen.x >= minX becomes dot(row0, v) - minX * w >= 0, and likewise for the other sides.
+// Only meaningful for vertices in front of the near plane, where w > 0.
+static std::array<glm::vec4, 4> screenPlanes(const Uniforms& uniforms, float minX, float minY, float maxX, float maxY) {
+    const glm::mat4& viewport = uniforms.viewport();
+    glm::vec4 rowX(viewport[0][0], viewport[1][0], viewport[2][0], viewport[3][0]);
+    glm::vec4 rowY(viewport[0][1], viewport[1][1], viewport[2][1], viewport[3][1]);
+    const glm::vec4 w(0.0f, 0.0f, 0.0f, 1.0f);
+    return {rowX - minX * w, maxX * w - rowX, rowY - minY * w, maxY * w - rowY};
+}
+
+// Bit i is set when the vertex is outside plane i
+static unsigned outcode(const std::array<glm::vec4, 4>& planes, const glm::vec4& vertex) {
+    unsigned code = 0;
+    for (unsigned i = 0; i < planes.size(); ++i) {
+        code |= glm::dot(planes[i], vertex) < 0.0f ? (1u << i) : 0u;
+    }
+    return code;
+}
+
+// One Sutherland-Hodgman pass: keeps the part of the polygon on the inside of the plane
+static void clipPolygon(std::vector<glm::vec4>& polygon, std::vector<glm::vec4>& scratch, const glm::vec4& plane) {
+    scratch.clear();
+    for (size_t i = 0; i < polygon.size(); ++i) {
+        const glm::vec4& current = polygon[i];
+        const glm::vec4& next = polygon[(i + 1) % polygon.size()];
+        float currentDistance = glm::dot(plane, current);
+        float nextDistance = glm::dot(plane, next);
+
+        if (currentDistance >= 0.0f) {
+            scratch.push_back(current);
+        }
+        if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f)) {
+            float t = currentDistance / (currentDistance - nextDistance);
+            scratch.push_back(current + t * (next - current));
+        }
+    }
+    polygon.swap(scratch);
+}
+
+std::vector<glm::vec4> clipTriangles(
+        const std::vector<glm::vec4>& clipSpaceVertices,
+        const Uniforms& uniforms,
+        const PipelineState& state
+) {
+    std::vector<glm::vec4> clippedVertices;
+    clippedVertices.reserve(clipSpaceVertices.size());
+
+    const Scissor& scissor = state.scissor;
+    auto scissorPlanes = screenPlanes(uniforms,
+                                      static_cast<float>(scissor.x), static_cast<float>(scissor.y),
+                                      static_cast<float>(scissor.x + scissor.width),
+                                      static_cast<float>(scissor.y + scissor.height));
+    auto guardBandPlanes = screenPlanes(uniforms,
+                                        static_cast<float>(scissor.x) - GUARD_BAND,
+                                        static_cast<float>(scissor.y) - GUARD_BAND,
+                                        static_cast<float>(scissor.x + scissor.width) + GUARD_BAND,
+                                        static_cast<float>(scissor.y + scissor.height) + GUARD_BAND);
+
+    std::vector<glm::vec4> polygon;
+    std::vector<glm::vec4> scratch;
+    for (size_t i = 0; i + 2 < clipSpaceVertices.size(); i += 3) {
+        const glm::vec4& A = clipSpaceVertices[i];
+        const glm::vec4& B = clipSpaceVertices[i + 1];
+        const glm::vec4& C = clipSpaceVertices[i + 2];
+        bool insideA = glm::dot(NEAR_PLANE, A) >= 0.0f;
+        bool insideB = glm::dot(NEAR_PLANE, B) >= 0.0f;
+        bool insideC = glm::dot(NEAR_PLANE, C) >= 0.0f;
+        if (!insideA && !insideB && !insideC) {
+            continue;
+        }
+
+        // Common case: in front of the camera and within the guard band, passed on as is
+        if (insideA && insideB && insideC) {
+            if ((outcode(scissorPlanes, A) & outcode(scissorPlanes, B) & outcode(scissorPlanes, C)) != 0) {
+                continue;
+            }
+            if ((outcode(guardBandPlanes, A) | outcode(guardBandPlanes, B) | outcode(guardBandPlanes, C)) == 0) {
+                clippedVertices.push_back(A);
+                clippedVertices.push_back(B);
+                clippedVertices.push_back(C);
+                continue;
+            }
+        }
+
+        polygon.assign({A, B, C});
+        if (!insideA || !insideB || !insideC) {
+            clipPolygon(polygon, scratch, NEAR_PLANE);
+        }
+
+        // Wholly outside the scissor rectangle: nothing to rasterize
+        unsigned scissorAnd = ~0u;
+        unsigned guardBandOr = 0;
+        for (const glm::vec4& vertex : polygon) {
+            scissorAnd &= outcode(scissorPlanes, vertex);
+            guardBandOr |= outcode(guardBandPlanes, vertex);
+        }
+        if (scissorAnd != 0) {
+            continue;
+        }
+
+        // Only triangles reaching past the guard band are clipped against it
+        for (unsigned plane = 0; plane < guardBandPlanes.size() && polygon.size() >= 3; ++plane) {
+            if (guardBandOr & (1u << plane)) {
+                clipPolygon(polygon, scratch, guardBandPlanes[plane]);
+            }
+        }
+
+        // Fan the (possibly clipped) polygon back into triangles
+        for (size_t k = 2; k < polygon.size(); ++k) {
+            clippedVertices.push_back(polygon[0]);
+            clippedVertices.push_back(polygon[k - 1]);
+            clippedVertices.push_back(polygon[k]);
+        }
+    }
+
+    return clippedVertices;
+}
+
+std::vector<std::array<glm::vec3, 3>> primitiveAssembly(
+        const std::vector<glm::vec4>& clippedVertices,
+        const Uniforms& uniforms,
+        const PipelineState& state,
+        RenderStats& stats
 ) {
-    std::vector<std::vector<glm::vec3>> triangles;
+    std::vector<std::array<glm::vec3, 3>> triangles;
+    triangles.reserve(clippedVertices.size() / 3);
+
+    // Counter-clockwise in NDC has a positive signed area; a mirroring viewport flips the sign
+    const glm::mat4& viewport = uniforms.viewport();
+    float frontFacing = viewport[0][0] * viewport[1][1] - viewport[1][0] * viewport[0][1] < 0.0f ? -1.0f : 1.0f;
+
+    // We will group the clipped vertices in sets of 3 to form triangles in screen space
+    for (size_t i = 0; i + 2 < clippedVertices.size(); i += 3) {
+        glm::vec3 A = viewportTransform(clippedVertices[i], uniforms);
+        glm::vec3 B = viewportTransform(clippedVertices[i + 1], uniforms);
+        glm::vec3 C = viewportTransform(clippedVertices[i + 2], uniforms);
+        ++stats.triangles;
 
-    // We will group the transformed vertices in sets of 3 to form triangles
-    for (size_t i = 0; i < transformedVertices.size(); i += 3) {
-        std::vector<glm::vec3> triangle;
-        triangle.push_back(transformedVertices[i]);
-        triangle.push_back(transformedVertices[i + 1]);
-        triangle.push_back(transformedVertices[i + 2]);
-        triangles.push_back(triangle);
+        // Twice the signed screen-space area, positive for front faces
+        float area = ((B.x - A.x) * (C.y - A.y) - (C.x - A.x) * (B.y - A.y)) * frontFacing;
+        if (!(area != 0.0f)) {
+            ++stats.degenerateTriangles;
+            continue;
+        }
+        if ((state.cullMode == CullMode::Back && area < 0.0f) ||
+            (state.cullMode == CullMode::Front && area > 0.0f)) {
+            ++stats.culledTriangles;
+            continue;
+        }
+
+        triangles.push_back({A, B, C});
     }
 
     return triangles;
 }
 
-std::vector<Fragment> rasterize(const std::vector<std::vector<glm::vec3>>& assembledVertices) {
-    std::vector<Fragment> fragments;
+void Framebuffer::resize(int width, int height) {
+    this->width = width;
+    this->height = height;
+    pixels.resize(static_cast<size_t>(width) * height);
+}
 
-    for (const std::vector<glm::vec3>& triangleVertices : assembledVertices) {
-        std::vector<Fragment> triangleFragments = triangle(triangleVertices[0], triangleVertices[1], triangleVertices[2]);
-        fragments.insert(fragments.end(), triangleFragments.begin(), triangleFragments.end());
+void Framebuffer::clear(const Color& color) {
+    std::fill(pixels.begin(), pixels.end(), color);
+}
+
+// Edge through U and V, positive on the left of U -> V in a y-up frame
+static EdgeFunction edgeFunction(const glm::vec3& U, const glm::vec3& V) {
+    EdgeFunction edge;
+    edge.a = U.y - V.y;
+    edge.b = V.x - U.x;
+    edge.c = -(edge.a * V.x + edge.b * V.y);
+    return edge;
+}
+
+int subpixelBits(SubpixelPrecision precision) {
+    switch (precision) {
+        case SubpixelPrecision::Fixed4:
+            return 4;
+        case SubpixelPrecision::Fixed8:
+            return 8;
+        default:
+            return 0;
     }
+}
+
+// Vertex snapped to the subpixel grid
+struct FixedPoint {
+    int64_t x;
+    int64_t y;
+};
+
+// Same orientation as edgeFunction, in fixed point. c is the cross product of the two
+// vertices, so the edge seen from the other triangle sharing it is exactly the negation.
+static FixedEdgeFunction fixedEdgeFunction(const FixedPoint& U, const FixedPoint& V) {
+    FixedEdgeFunction edge;
+    edge.a = U.y - V.y;
+    edge.b = V.x - U.x;
+    edge.c = U.x * V.y - U.y * V.x;
+    return edge;
+}
+
+std::vector<TriangleSetup> triangleSetup(
+        const std::vector<std::array<glm::vec3, 3>>& triangles,
+        const PipelineState& state
+) {
+    std::vector<TriangleSetup> setups;
+    setups.reserve(triangles.size());
+
+    const Scissor& scissor = state.scissor;
+    const int bits = subpixelBits(state.subpixelPrecision);
+    const float subpixelScale = static_cast<float>(1 << bits);
+    for (const std::array<glm::vec3, 3>& triangle : triangles) {
+        TriangleSetup setup;
+        setup.vertices = triangle;
+        setup.subpixelBits = bits;
+
+        // Snap to the subpixel grid first, so that everything below is derived from the
+        // triangle that is actually rasterized
+        std::array<FixedPoint, 3> fixedVertices;
+        if (bits > 0) {
+            for (int i = 0; i < 3; ++i) {
+                glm::vec3& vertex = setup.vertices[i];
+                fixedVertices[i] = {std::lround(vertex.x * subpixelScale), std::lround(vertex.y * subpixelScale)};
+                vertex.x = static_cast<float>(fixedVertices[i].x) / subpixelScale;
+                vertex.y = static_cast<float>(fixedVertices[i].y) / subpixelScale;
+            }
+            setup.fixedEdges = {fixedEdgeFunction(fixedVertices[1], fixedVertices[2]),
+                                fixedEdgeFunction(fixedVertices[2], fixedVertices[0]),
+                                fixedEdgeFunction(fixedVertices[0], fixedVertices[1])};
+        }
+
+        const glm::vec3& A = setup.vertices[0];
+        const glm::vec3& B = setup.vertices[1];
+        const glm::vec3& C = setup.vertices[2];
+        setup.edges = {edgeFunction(B, C), edgeFunction(C, A), edgeFunction(A, B)};
+
+        // Every edge function equals twice the signed area at the opposite vertex. Flip clockwise
+        // triangles so that the interior is positive whatever the winding. The fixed-point area
+        // is exact, so it decides when there is one.
+        float doubleArea = setup.edges[0].evaluate(A.x, A.y);
+        if (bits > 0) {
+            int64_t fixedDoubleArea = setup.fixedEdges[0].evaluate(fixedVertices[0].x, fixedVertices[0].y);
+            doubleArea = static_cast<float>(fixedDoubleArea) / (subpixelScale * subpixelScale);
+        }
+        if (!(doubleArea != 0.0f)) {
+            continue;
+        }
+        if (doubleArea < 0.0f) {
+            for (EdgeFunction& edge : setup.edges) {
+                edge = {-edge.a, -edge.b, -edge.c};
+            }
+            for (FixedEdgeFunction& edge : setup.fixedEdges) {
+                edge = {-edge.a, -edge.b, -edge.c};
+            }
+            doubleArea = -doubleArea;
+        }
+        setup.inverseArea = 1.0f / doubleArea;
+
+        // Depth gradient from the barycentric weights, anchored at A rather than the origin so the
+        // constant term does not lose z's precision to large screen coordinates
+        float depthDx = (setup.edges[0].a * A.z + setup.edges[1].a * B.z + setup.edges[2].a * C.z) * setup.inverseArea;
+        float depthDy = (setup.edges[0].b * A.z + setup.edges[1].b * B.z + setup.edges[2].b * C.z) * setup.inverseArea;
+        setup.depthPlane = {depthDx, depthDy, A.z - depthDx * A.x - depthDy * A.y};
 
-    return fragments;
-}
\ No newline at end of file
+        if (bits > 0) {
+            for (FixedEdgeFunction& edge : setup.fixedEdges) {
+                if (!edge.isTopLeft()) {
+                    edge.c -= 1;
+                }
+            }
+        }
+
+        // Bounding box of the pixels whose centers can be covered, clamped to the scissor rectangle
+        setup.minX = std::max(min3(static_cast<int>(std::floor(A.x)), static_cast<int>(std::floor(B.x)),
+                                   static_cast<int>(std::floor(C.x))), scissor.x);
+        setup.minY = std::max(min3(static_cast<int>(std::floor(A.y)), static_cast<int>(std::floor(B.y)),
+                                   static_cast<int>(std::floor(C.y))), scissor.y);
+        setup.maxX = std::min(max3(static_cast<int>(std::floor(A.x)), static_cast<int>(std::floor(B.x)),
+                                   static_cast<int>(std::floor(C.x))), scissor.x + scissor.width - 1);
+        setup.maxY = std::min(max3(static_cast<int>(std::floor(A.y)), static_cast<int>(std::floor(B.y)),
+                                   static_cast<int>(std::floor(C.y))), scissor.y + scissor.height - 1);
+        if (setup.minX > setup.maxX || setup.minY > setup.maxY) {
+            continue;
+        }
+
+        setups.push_back(setup);
+    }
+
+    return setups;
+}
+
+void rasterize(const std::vector<TriangleSetup>& setups, const PipelineState& state, DepthBuffer& depthBuffer,
+               RenderStats& stats, const FragmentSink& sink, ThreadPool* threadPool) {
+    rasterize(setups, binTriangles(setups, state.scissor), state, depthBuffer, stats, sink, threadPool);
+}
+
+void rasterize(const std::vector<TriangleSetup>& setups, const TileBins& bins, const PipelineState& state,
+               DepthBuffer& depthBuffer, RenderStats& stats, const FragmentSink& sink, ThreadPool* threadPool) {
+    depthBuffer.resize(bins.tilesX, bins.tilesY);
+    std::vector<RenderStats> tileStats(bins.triangles.size());
+
+    // One scratch buffer per thread, kept from frame to frame: once it has grown to a batch plus a
+    // triangle's fragments in a tile, rasterization stops allocating
+    auto rasterizeTileTask = [&](size_t tile) {
+        thread_local std::vector<Fragment> scratch;
+        rasterizeTile(setups, bins, tile, state, depthBuffer, sink, scratch, tileStats[tile]);
+    };
+    if (threadPool != nullptr) {
+        threadPool->parallelFor(tileStats.size(), rasterizeTileTask);
+    } else {
+        for (size_t tile = 0; tile < tileStats.size(); ++tile) {
+            rasterizeTileTask(tile);
+        }
+    }
+
+    for (const RenderStats& tile : tileStats) {
+        stats.coveredPixels += tile.coveredPixels;
+        stats.acceptedBlockPixels += tile.acceptedBlockPixels;
+        stats.hiZRejectedPixels += tile.hiZRejectedPixels;
+        stats.shadedFragments += tile.shadedFragments;
+    }
+}
@@ -2,8 +2,11 @@
 
 #include "glm/glm.hpp"
 #include <vector>
+#include <cstdint>
 #include <array>
+#include <functional>
 #include <iostream>
+#include <span>
 
 // Define a Color struct to hold the RGB values of a pixel
 struct Color {
@@ -13,9 +16,26 @@ struct Color {
     uint8_t a;
 };
 
+// Linear RGBA8 color buffer the fragment stage writes to, row by row from the top-left pixel.
+// Color's byte order is that of SDL_PIXELFORMAT_RGBA32, so it is uploaded to the screen as is.
+struct Framebuffer {
+    int width = 0;
+    int height = 0;
+    std::vector<Color> pixels;
+
+    void resize(int width, int height);
+
+    void clear(const Color& color);
+
+    Color& at(int x, int y) {
+        return pixels[static_cast<size_t>(y) * width + x];
+    }
+};
+
 // Define the Fragment struct here
 struct Fragment {
     glm::ivec2 position; // X and Y coordinates of the pixel (in screen space)
+    float depth = 0.0f; // Screen-space z interpolated at the pixel center
     // Other interpolated attributes (e.g., color, texture coordinates, normals) can be added here
 
     Fragment() : position(glm::ivec2(0, 0)) {}
@@ -23,17 +43,262 @@ struct Fragment {
     Fragment(const glm::ivec2& pos) : position(pos) {}
 };
 
-struct Face {
-    std::vector<std::array<int, 3>> vertexIndices;
+// Polygon mesh with its faces stored flat, instead of one allocation per face. The corners of
+// face f are entries faceOffsets[f] to faceOffsets[f + 1] - 1 of the three index arrays, which
+// hold zero-based OBJ indices (-1 where a corner has no texcoord or normal).
+struct Mesh {
+    std::vector<glm::vec3> positions;
+    std::vector<int> positionIndices;
+    std::vector<int> texCoordIndices;
+    std::vector<int> normalIndices;
+    std::vector<uint32_t> faceOffsets = {0};
+
+    size_t faceCount() const {
+        return faceOffsets.size() - 1;
+    }
+
+    void clear() {
+        positions.clear();
+        positionIndices.clear();
+        texCoordIndices.clear();
+        normalIndices.clear();
+        faceOffsets.assign(1, 0);
+    }
+};
+
+// Vertex data for indexed drawing: every unique (position, texcoord, normal) index triple of
+// the mesh is stored once in vertices, and each triangle is three consecutive indices
+struct IndexedVertexArray {
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
 };
 
+// Transformation matrices of a draw. The source matrices are set through the setters, which
+// also update the products derived from them, so frames that keep their matrices never multiply
+// them again and a const Uniforms can be read from any number of threads.
 struct Uniforms {
-    glm::mat4 model;
-    glm::mat4 view;
-    glm::mat4 projection;
-    glm::mat4 viewport;
+    const glm::mat4& model() const { return modelMatrix; }
+    const glm::mat4& view() const { return viewMatrix; }
+    const glm::mat4& projection() const { return projectionMatrix; }
+    const glm::mat4& viewport() const { return viewportMatrix; }
+
+    void setModel(const glm::mat4& matrix) {
+        modelMatrix = matrix;
+        updateModelViewProjection();
+    }
+
+    void setView(const glm::mat4& matrix) {
+        viewMatrix = matrix;
+        updateModelViewProjection();
+    }
+
+    void setProjection(const glm::mat4& matrix) {
+        projectionMatrix = matrix;
+        updateModelViewProjection();
+    }
+
+    // The viewport applies after clipping and the perspective divide, nothing is derived from it
+    void setViewport(const glm::mat4& matrix) {
+        viewportMatrix = matrix;
+    }
+
+    // projection * view * model, multiplied in that order
+    const glm::mat4& modelViewProjection() const { return modelViewProjectionMatrix; }
+
+    // Compares the source matrices only
+    bool operator==(const Uniforms& other) const {
+        return modelMatrix == other.modelMatrix && viewMatrix == other.viewMatrix &&
+               projectionMatrix == other.projectionMatrix && viewportMatrix == other.viewportMatrix;
+    }
+
+private:
+    void updateModelViewProjection() {
+        modelViewProjectionMatrix = projectionMatrix * viewMatrix * modelMatrix;
+    }
+
+    glm::mat4 modelMatrix = glm::mat4(1.0f);
+    glm::mat4 viewMatrix = glm::mat4(1.0f);
+    glm::mat4 projectionMatrix = glm::mat4(1.0f);
+    glm::mat4 viewportMatrix = glm::mat4(1.0f);
+    glm::mat4 modelViewProjectionMatrix = glm::mat4(1.0f);
+};
+
+// Rectangle of the framebuffer, in pixels, that rasterization is restricted to
+struct Scissor {
+    int x;
+    int y;
+    int width;
+    int height;
+
+    bool operator==(const Scissor& other) const = default;
+};
+
+// Which triangles primitive assembly discards by facing. Front faces are counter-clockwise,
+// the OBJ convention.
+enum class CullMode {
+    None,
+    Back,
+    Front
+};
+
+// Comparison between a fragment's depth and the depth buffer's that lets the fragment through
+enum class CompareOp {
+    Never,
+    Less,
+    LessEqual,
+    Equal,
+    Greater,
+    GreaterEqual,
+    NotEqual,
+    Always
+};
+
+// Instruction set the rasterizer and the batched vertex stage run on. Every level covers exactly
+// the same pixels, the wider ones test more pixels (or transform more vertices) per instruction.
+enum class SimdLevel {
+    Scalar,
+    // 2x2 pixel blocks
+    SSE41,
+    // 4x2 pixel blocks
+    AVX2,
+    // 8x2 pixel blocks
+    AVX512
+};
+
+// How the rasterizer resolves vertex positions. In the fixed-point modes triangle setup snaps
+// vertices to a grid of 1/16 or 1/256 pixel and coverage is computed exactly in integers, so
+// triangles sharing an edge can never both cover, or both miss, a pixel on it.
+enum class SubpixelPrecision {
+    Float,
+    // 28.4 fixed point
+    Fixed4,
+    // 24.8 fixed point
+    Fixed8
 };
 
+// Fractional bits of a fixed-point mode, 0 for SubpixelPrecision::Float
+int subpixelBits(SubpixelPrecision precision);
+
+// Fixed-function state the pipeline stages are configured with
+struct PipelineState {
+    Scissor scissor = {0, 0, 0, 0};
+    CullMode cullMode = CullMode::None;
+    SimdLevel simdLevel = SimdLevel::Scalar;
+    SubpixelPrecision subpixelPrecision = SubpixelPrecision::Float;
+    // Early depth test, run before fragment shading: fragments failing depthCompare against the
+    // depth buffer are discarded. The buffer is reset to clearDepth every frame.
+    bool depthTest = false;
+    CompareOp depthCompare = CompareOp::Less;
+    bool depthWrite = true;
+    float clearDepth = 1.0f;
+
+    bool operator==(const PipelineState& other) const = default;
+};
+
+// Per-frame counters filled in by the pipeline stages
+struct RenderStats {
+    // Triangles that reached primitive assembly, after clipping
+    size_t triangles = 0;
+    // Rejected by the cull mode
+    size_t culledTriangles = 0;
+    // Zero screen-space area, nothing to rasterize
+    size_t degenerateTriangles = 0;
+    // Pixels covered by the rasterizer
+    size_t coveredPixels = 0;
+    // Covered pixels that came from blocks accepted whole, without testing each pixel
+    size_t acceptedBlockPixels = 0;
+    // Bounding box pixels skipped without coverage testing because Hi-Z proved every fragment
+    // there would fail the depth test
+    size_t hiZRejectedPixels = 0;
+    // Covered pixels that passed the depth test and went on to the fragment shader
+    size_t shadedFragments = 0;
+
+    bool operator==(const RenderStats& other) const = default;
+};
+
+// Time spent in the rasterizer over a number of frames, for throughput reporting
+struct RasterThroughput {
+    size_t coveredPixels = 0;
+    double seconds = 0.0;
+    // Threads the rasterizer ran on
+    unsigned cores = 1;
+
+    double pixelsPerSecondPerCore() const {
+        return seconds > 0.0 ? static_cast<double>(coveredPixels) / seconds / cores : 0.0;
+    }
+};
+
+// Triangles that stay within this many pixels around the scissor rectangle are not clipped
+// against it, the rasterizer clamps their bounding box instead. Only triangles reaching past
+// this guard band are clipped geometrically, which keeps screen coordinates in a safe range.
+const float GUARD_BAND = 4096.0f;
+
+// E(x, y) = a * x + b * y + c: zero on a triangle edge, and oriented by triangle setup to be
+// positive on the side of the triangle's interior
+struct EdgeFunction {
+    float a;
+    float b;
+    float c;
+
+    float evaluate(float x, float y) const {
+        return a * x + b * y + c;
+    }
+
+    // Top-left fill rule: a pixel center exactly on an edge belongs to the triangle only if
+    // that edge is a left edge (interior to its right) or a top edge (horizontal, interior below
+    // it in the y-down framebuffer). Two triangles sharing an edge see it with opposite
+    // orientations, so exactly one of them draws the pixels on it.
+    bool isTopLeft() const {
+        return a > 0.0f || (a == 0.0f && b > 0.0f);
+    }
+};
+
+// Edge function over snapped fixed-point coordinates, evaluated exactly in 64 bits. Vertices lie
+// within the guard band, so with 8 fractional bits coordinates stay below 2^22 and products
+// below 2^44. Triangle setup folds the fill rule into c: an edge that is not top-left has c
+// lowered by one, so that a pixel is covered exactly when all three values are >= 0.
+struct FixedEdgeFunction {
+    int64_t a;
+    int64_t b;
+    int64_t c;
+
+    int64_t evaluate(int64_t x, int64_t y) const {
+        return a * x + b * y + c;
+    }
+
+    // Same rule as EdgeFunction::isTopLeft
+    bool isTopLeft() const {
+        return a > 0 || (a == 0 && b > 0);
+    }
+};
+
+// Everything the rasterizers need about one triangle, computed once by triangle setup.
+// edges[i] is the edge opposite vertices[i], so the barycentric weight of vertex i at a pixel
+// is edges[i].evaluate(x, y) * inverseArea.
+struct TriangleSetup {
+    std::array<glm::vec3, 3> vertices;
+    std::array<EdgeFunction, 3> edges;
+    // 1 / (2 * area), the reciprocal of every edge function's value at the opposite vertex
+    float inverseArea;
+    // Pixel bounding box, already clamped to the scissor rectangle
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+    // Fractional bits of the fixed-point mode, 0 when coverage is computed from the float edges.
+    // In a fixed-point mode the vertices and float edges are those of the snapped triangle, and
+    // fixedEdges are in units of 1 / 2^subpixelBits pixel.
+    int subpixelBits = 0;
+    std::array<FixedEdgeFunction, 3> fixedEdges;
+    // z as a function of the pixel position, in the same form as an edge function: after the
+    // perspective divide z varies linearly across the screen
+    EdgeFunction depthPlane;
+};
+
+struct ThreadPool;
+struct DepthBuffer;
+struct TileBins;
+
 struct Camera {
     glm::vec3 cameraPosition;
     glm::vec3 targetPosition;
@@ -56,16 +321,53 @@ int min3(int a, int b, int c);
 
 int max3(int a, int b, int c);
 
-std::vector<Fragment> triangle(const glm::vec3& A, const glm::vec3& B, const glm::vec3& C);
+// Appends the pixels the triangle covers to fragments, row by row
+void triangle(const TriangleSetup& setup, std::vector<Fragment>& fragments);
 
-std::vector<std::vector<glm::vec3>> primitiveAssembly(const std::vector<glm::vec3>& transformedVertices);
+// Clip stage, in homogeneous clip space before the perspective divide: clips every triangle
+// against the near plane, drops triangles outside the scissor rectangle and clips those that
+// reach past the guard band. Clipped triangles come out fanned into several triangles.
+std::vector<glm::vec4> clipTriangles(const std::vector<glm::vec4>& clipSpaceVertices, const Uniforms& uniforms,
+                                     const PipelineState& state);
 
-std::vector<Fragment> rasterize(const std::vector<std::vector<glm::vec3>>& assembledVertices);
+// Perspective divide and viewport transform of a clipped vertex
+glm::vec3 viewportTransform(const glm::vec4& clipSpaceVertex, const Uniforms& uniforms);
 
-Color fragmentShader(const Fragment& fragment);
+// Maps clipped triangles to screen space, dropping degenerate ones and those the cull mode rejects
+std::vector<std::array<glm::vec3, 3>> primitiveAssembly(const std::vector<glm::vec4>& clippedVertices,
+                                                        const Uniforms& uniforms, const PipelineState& state,
+                                                        RenderStats& stats);
+
+// Triangle setup: turns screen-space triangles into the records every rasterizer works from.
+// Triangles whose bounding box misses the scissor rectangle are dropped.
+std::vector<TriangleSetup> triangleSetup(const std::vector<std::array<glm::vec3, 3>>& triangles,
+                                         const PipelineState& state);
+
+// Receives the fragments of a frame as they are rasterized, one batch at a time. A batch belongs
+// to a single tile and is only valid during the call.
+using FragmentSink = std::function<void(std::span<const Fragment>)>;
 
-glm::vec3 vertexShader(const glm::vec3& vertex, const Uniforms& uniforms);
+// Fragments a tile accumulates before they are handed to the sink. Batches are this size or
+// larger, by at most one triangle's fragments within a tile, except the last of each tile.
+const size_t FRAGMENT_BATCH_SIZE = 1024;
 
-bool loadOBJ(const std::string& path, std::vector<glm::vec3>& out_vertices, std::vector<Face>& out_faces);
+// Rasterizes every triangle with the kernel of state.simdLevel, falling back to triangle() at
+// SimdLevel::Scalar, and streams the fragments to sink in batches: no buffer ever holds a whole
+// frame's fragments. Triangles are binned into screen tiles which are rasterized on threadPool
+// (or on the calling thread without one), so sink is called concurrently for different tiles.
+// Each tile's batches arrive in order with its fragments in submission order, and tiles share no
+// pixels, so the final image does not depend on the number of threads. With state.depthTest,
+// fragments hidden by earlier triangles are discarded against depthBuffer before they reach the
+// sink, so they are never shaded.
+void rasterize(const std::vector<TriangleSetup>& setups, const PipelineState& state, DepthBuffer& depthBuffer,
+               RenderStats& stats, const FragmentSink& sink, ThreadPool* threadPool = nullptr);
+
+// Same, with setups already binned by binTriangles(setups, state.scissor), so binning can run as a
+// job of its own ahead of rasterization
+void rasterize(const std::vector<TriangleSetup>& setups, const TileBins& bins, const PipelineState& state,
+               DepthBuffer& depthBuffer, RenderStats& stats, const FragmentSink& sink,
+               ThreadPool* threadPool = nullptr);
+
+Color fragmentShader(const Fragment& fragment);
 
-std::vector<glm::vec3> setupVertexArray(const std::vector<glm::vec3>& vertices, const std::vector<Face>& faces);
+IndexedVertexArray setupVertexArray(const Mesh& mesh);
@@ -0,0 +1,246 @@
+#include "threadPool.hpp"
+#include <algorithm>
+#include <chrono>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Slot of the pool a thread runs jobs from. Threads outside the pool use slot 0.
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local unsigned currentPoolSlot = 0;
+
+static void pinCurrentThread(unsigned cpu) {
+#if defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << (cpu % 64));
+#elif defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu % CPU_SETSIZE, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+    (void)cpu;
+#endif
+}
+
+ThreadPool::ThreadPool(unsigned threadCount, bool pinThreads) {
+    unsigned hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    if (threadCount == 0) {
+        threadCount = hardwareThreads;
+    }
+    for (unsigned i = 0; i < threadCount; ++i) {
+        slots.push_back(std::make_unique<Slot>());
+    }
+
+    // Slot i runs on CPU i: the constructing thread, which runs slot 0's jobs while it waits,
+    // takes CPU 0 and the workers the CPUs after it
+    if (pinThreads) {
+        pinCurrentThread(0);
+    }
+    for (unsigned i = 1; i < threadCount; ++i) {
+        workers.emplace_back([this, i, pinThreads, hardwareThreads] {
+            if (pinThreads) {
+                pinCurrentThread(i % hardwareThreads);
+            }
+            workerLoop(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned ThreadPool::currentSlot() const {
+    return currentPool == this ? currentPoolSlot : 0;
+}
+
+void ThreadPool::enqueue(JobHandle job) {
+    // Counted before it is visible, so the count never drops below the jobs actually queued
+    queuedJobs.fetch_add(1);
+    Slot& slot = *slots[currentSlot()];
+    {
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        slot.jobs.push_back(std::move(job));
+    }
+
+    // A worker going to sleep registers before it checks queuedJobs, so either it sees this job
+    // or it is seen here and woken up
+    if (sleepingWorkers.load() > 0) {
+        { std::lock_guard<std::mutex> lock(sleepMutex); }
+        wake.notify_one();
+    }
+}
+
+JobHandle ThreadPool::submit(std::function<void()> task, std::span<const JobHandle> dependencies) {
+    JobHandle job = std::make_shared<Job>();
+    job->task = std::move(task);
+    for (const JobHandle& dependency : dependencies) {
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (!dependency->finished.load()) {
+            dependency->dependents.push_back(job);
+            job->pendingDependencies.fetch_add(1);
+        }
+    }
+
+    // Drop the submission's own count; the last dependency to finish queues the job otherwise
+    if (job->pendingDependencies.fetch_sub(1) == 1) {
+        enqueue(job);
+    }
+    return job;
+}
+
+void ThreadPool::finish(const JobHandle& job) {
+    // Release whatever the task captured before anyone waiting sees the job as finished
+    job->task = nullptr;
+
+    std::vector<JobHandle> dependents;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->finished.store(true);
+        dependents.swap(job->dependents);
+    }
+    // Same handshake as enqueue: a thread blocking in wait registers before it checks finished
+    if (waitingThreads.load() > 0) {
+        { std::lock_guard<std::mutex> lock(sleepMutex); }
+        wake.notify_all();
+    }
+    for (JobHandle& dependent : dependents) {
+        if (dependent->pendingDependencies.fetch_sub(1) == 1) {
+            enqueue(std::move(dependent));
+        }
+    }
+}
+
+bool ThreadPool::runOneJob(unsigned slot) {
+    JobHandle job;
+    bool stolen = false;
+    {
+        Slot& own = *slots[slot];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+        }
+    }
+    for (unsigned i = 1; job == nullptr && i < slots.size(); ++i) {
+        Slot& victim = *slots[(slot + i) % slots.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            stolen = true;
+        }
+    }
+    if (job == nullptr) {
+        return false;
+    }
+    queuedJobs.fetch_sub(1);
+
+    auto start = std::chrono::steady_clock::now();
+    job->task();
+    auto busy = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    Slot& own = *slots[slot];
+    own.jobCount.fetch_add(1, std::memory_order_relaxed);
+    own.stolenCount.fetch_add(stolen ? 1 : 0, std::memory_order_relaxed);
+    own.busyNanoseconds.fetch_add(static_cast<uint64_t>(busy.count()), std::memory_order_relaxed);
+
+    finish(job);
+    return true;
+}
+
+void ThreadPool::workerLoop(unsigned slot) {
+    currentPool = this;
+    currentPoolSlot = slot;
+    while (true) {
+        if (runOneJob(slot)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers.fetch_add(1);
+        wake.wait(lock, [&] { return stopping || queuedJobs.load() > 0; });
+        sleepingWorkers.fetch_sub(1);
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::wait(const JobHandle& job) {
+    // The job may still be waiting for dependencies that other threads are running: help with
+    // whatever is queued meanwhile, and sleep like an idle worker once nothing is
+    unsigned slot = currentSlot();
+    while (!job->finished.load()) {
+        if (runOneJob(slot)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers.fetch_add(1);
+        waitingThreads.fetch_add(1);
+        wake.wait(lock, [&] { return queuedJobs.load() > 0 || job->finished.load(); });
+        waitingThreads.fetch_sub(1);
+        sleepingWorkers.fetch_sub(1);
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& task) {
+    if (slots.size() == 1 || count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    // One job per thread, each pulling indices until none are left
+    std::atomic<size_t> nextIndex {0};
+    auto runTasks = [&] {
+        for (size_t i = nextIndex.fetch_add(1); i < count; i = nextIndex.fetch_add(1)) {
+            task(i);
+        }
+    };
+    size_t jobCount = std::min<size_t>(count, slots.size());
+    std::vector<JobHandle> jobs;
+    jobs.reserve(jobCount);
+    for (size_t i = 0; i < jobCount; ++i) {
+        jobs.push_back(submit(runTasks));
+    }
+    for (const JobHandle& job : jobs) {
+        wait(job);
+    }
+}
+
+std::vector<WorkerStats> ThreadPool::workerStats() const {
+    std::vector<WorkerStats> stats;
+    stats.reserve(slots.size());
+    for (const std::unique_ptr<Slot>& slot : slots) {
+        WorkerStats worker;
+        worker.jobs = slot->jobCount.load(std::memory_order_relaxed);
+        worker.stolenJobs = slot->stolenCount.load(std::memory_order_relaxed);
+        worker.busySeconds = static_cast<double>(slot->busyNanoseconds.load(std::memory_order_relaxed)) * 1e-9;
+        stats.push_back(worker);
+    }
+    return stats;
+}
+
+void ThreadPool::resetWorkerStats() {
+    for (const std::unique_ptr<Slot>& slot : slots) {
+        slot->jobCount.store(0, std::memory_order_relaxed);
+        slot->stolenCount.store(0, std::memory_order_relaxed);
+        slot->busyNanoseconds.store(0, std::memory_order_relaxed);
+    }
+}
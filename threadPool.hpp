@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+// A unit of work for the ThreadPool. It becomes runnable once every job it depends on has finished.
+struct Job {
+    std::function<void()> task;
+    // Dependencies not finished yet, plus one while the job is being submitted
+    std::atomic<int> pendingDependencies {1};
+    std::atomic<bool> finished {false};
+    // Jobs waiting on this one, guarded by mutex until finished is set
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Job>> dependents;
+};
+
+// Handle to a submitted job, for waiting on it or making later jobs depend on it
+using JobHandle = std::shared_ptr<Job>;
+
+// What one thread of the pool has done since the counters were last reset
+struct WorkerStats {
+    uint64_t jobs = 0;
+    // Jobs taken from another thread's deque
+    uint64_t stolenJobs = 0;
+    // Time spent running jobs
+    double busySeconds = 0.0;
+};
+
+// Work-stealing job scheduler with a fixed set of worker threads that stay alive between frames.
+// Every thread owns a deque: it pushes and pops its own jobs at the back, most recent first while
+// they are still in cache, and threads that run out of work steal the oldest jobs from the front
+// of the others'. Slot 0 belongs to the threads outside the pool, which run jobs while they wait.
+struct ThreadPool {
+    // threadCount counts the calling thread too (0 = one per hardware thread). With pinThreads,
+    // the calling thread is pinned to CPU 0 and worker i to CPU i, wrapping around when there
+    // are more threads than CPUs.
+    explicit ThreadPool(unsigned threadCount = 0, bool pinThreads = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned threadCount() const { return static_cast<unsigned>(slots.size()); }
+
+    // Queues task to run once every job in dependencies has finished, on the submitting thread's
+    // deque. Jobs form a DAG: a dependency must have been submitted before its dependents.
+    JobHandle submit(std::function<void()> task, std::span<const JobHandle> dependencies = {});
+
+    // Runs queued jobs until job has finished, sleeping while there are none
+    void wait(const JobHandle& job);
+
+    // Runs task(i) for every i in [0, count) on the workers and the calling thread, and returns
+    // once all of them are done. Indices are handed out one at a time, so uneven tasks balance.
+    void parallelFor(size_t count, const std::function<void(size_t)>& task);
+
+    // Per thread counters, slot 0 first
+    std::vector<WorkerStats> workerStats() const;
+    void resetWorkerStats();
+
+private:
+    struct Slot {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs;
+        std::atomic<uint64_t> jobCount {0};
+        std::atomic<uint64_t> stolenCount {0};
+        std::atomic<uint64_t> busyNanoseconds {0};
+    };
+
+    void workerLoop(unsigned slot);
+    void enqueue(JobHandle job);
+    // Pops a job from the thread's own deque or steals one; false when every deque is empty
+    bool runOneJob(unsigned slot);
+    void finish(const JobHandle& job);
+    unsigned currentSlot() const;
+
+    std::vector<std::unique_ptr<Slot>> slots;
+    std::vector<std::thread> workers;
+    // Jobs sitting in a deque. Idle workers sleep until it is non-zero.
+    std::atomic<size_t> queuedJobs {0};
+    // Sleeping threads, workers and waiters alike; finishing a job only wakes the waiters
+    std::atomic<unsigned> sleepingWorkers {0};
+    std::atomic<unsigned> waitingThreads {0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
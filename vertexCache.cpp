@@ -0,0 +1,162 @@
+#include "vertexCache.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+float computeACMR(std::span<const uint32_t> indices, int cacheSize) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return 0.0f;
+    }
+
+    // A FIFO only changes on a miss, so a vertex is still cached while fewer than cacheSize
+    // misses happened since it was inserted
+    uint32_t vertexCount = *std::max_element(indices.begin(), indices.end()) + 1;
+    std::vector<int64_t> insertedAt(vertexCount, -static_cast<int64_t>(cacheSize) - 1);
+    int64_t misses = 0;
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+        uint32_t index = indices[i];
+        if (misses - insertedAt[index] >= cacheSize) {
+            insertedAt[index] = misses;
+            ++misses;
+        }
+    }
+
+    return static_cast<float>(misses) / static_cast<float>(triangleCount);
+}
+
+// Scoring constants from Forsyth's paper
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+// Vertices in the cache score higher the more recently they were used; vertices with few
+// triangles left score higher so that they get finished off instead of leaving lone triangles
+static float vertexScore(int cachePosition, uint32_t remainingTriangles) {
+    if (remainingTriangles == 0) {
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // The triangle just emitted: fixed score so there is no preference between its three edges
+            score = LAST_TRIANGLE_SCORE;
+        } else {
+            float scale = 1.0f / static_cast<float>(VERTEX_CACHE_SIZE - 3);
+            score = std::pow(1.0f - static_cast<float>(cachePosition - 3) * scale, CACHE_DECAY_POWER);
+        }
+    }
+    score += VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), -VALENCE_BOOST_POWER);
+    return score;
+}
+
+void optimizeVertexCache(std::span<uint32_t> indices, size_t vertexCount) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Triangles using each vertex; the first remaining[v] entries of a vertex are the ones not emitted yet
+    std::vector<uint32_t> firstTriangle(vertexCount + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+        ++firstTriangle[indices[i] + 1];
+    }
+    for (size_t v = 0; v < vertexCount; ++v) {
+        firstTriangle[v + 1] += firstTriangle[v];
+    }
+    std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+        uint32_t vertex = indices[i];
+        vertexTriangles[firstTriangle[vertex] + remaining[vertex]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> score(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        score[v] = vertexScore(-1, remaining[v]);
+    }
+    std::vector<float> triangleScore(triangleCount, 0.0f);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+        triangleScore[i / 3] += score[indices[i]];
+    }
+    std::vector<bool> emitted(triangleCount, false);
+
+    // LRU order, with room for the 3 vertices of the new triangle before the oldest ones drop out
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> nextCache;
+    cache.reserve(VERTEX_CACHE_SIZE + 3);
+    nextCache.reserve(VERTEX_CACHE_SIZE + 3);
+
+    std::vector<uint32_t> output;
+    output.reserve(triangleCount * 3);
+
+    int64_t best = std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin();
+    size_t scanPosition = 0;
+    while (output.size() < triangleCount * 3) {
+        if (best < 0) {
+            // Nothing left around the cache: continue with the next triangle in the original order
+            while (emitted[scanPosition]) {
+                ++scanPosition;
+            }
+            best = static_cast<int64_t>(scanPosition);
+        }
+
+        emitted[best] = true;
+        nextCache.clear();
+        for (int corner = 0; corner < 3; ++corner) {
+            uint32_t vertex = indices[best * 3 + corner];
+            output.push_back(vertex);
+
+            // Remove the triangle from the vertex's list of remaining triangles
+            uint32_t* triangles = &vertexTriangles[firstTriangle[vertex]];
+            uint32_t* found = std::find(triangles, triangles + remaining[vertex], static_cast<uint32_t>(best));
+            std::swap(*found, triangles[--remaining[vertex]]);
+
+            if (std::find(nextCache.begin(), nextCache.end(), vertex) == nextCache.end()) {
+                nextCache.push_back(vertex);
+            }
+        }
+        for (uint32_t vertex : cache) {
+            if (std::find(nextCache.begin(), nextCache.end(), vertex) == nextCache.end()) {
+                nextCache.push_back(vertex);
+            }
+        }
+        std::swap(cache, nextCache);
+
+        // Rescore every vertex whose cache position changed and pass the difference on to its
+        // remaining triangles
+        for (size_t position = 0; position < cache.size(); ++position) {
+            uint32_t vertex = cache[position];
+            cachePosition[vertex] = position < VERTEX_CACHE_SIZE ? static_cast<int>(position) : -1;
+            float newScore = vertexScore(cachePosition[vertex], remaining[vertex]);
+            float delta = newScore - score[vertex];
+            score[vertex] = newScore;
+
+            const uint32_t* triangles = &vertexTriangles[firstTriangle[vertex]];
+            for (uint32_t i = 0; i < remaining[vertex]; ++i) {
+                triangleScore[triangles[i]] += delta;
+            }
+        }
+        if (cache.size() > VERTEX_CACHE_SIZE) {
+            cache.resize(VERTEX_CACHE_SIZE);
+        }
+
+        // The next triangle is the best one that still touches the cache
+        best = -1;
+        float bestScore = -1.0f;
+        for (uint32_t vertex : cache) {
+            const uint32_t* triangles = &vertexTriangles[firstTriangle[vertex]];
+            for (uint32_t i = 0; i < remaining[vertex]; ++i) {
+                if (triangleScore[triangles[i]] > bestScore) {
+                    bestScore = triangleScore[triangles[i]];
+                    best = triangles[i];
+                }
+            }
+        }
+    }
+
+    std::copy(output.begin(), output.end(), indices.begin());
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "shaders.hpp"
+#include <cstdint>
+#include <span>
+
+// Entries of the FIFO vertex cache the metric and the optimizer below model, in the range of a
+// GPU's post-transform cache
+const int VERTEX_CACHE_SIZE = 32;
+
+// Average cache miss ratio: misses per triangle when the index buffer is read through a FIFO
+// cache of cacheSize entries. 3 means no reuse at all, 0.5 is the best a regular grid can do.
+// The vertex stage shades every vertex exactly once per frame whatever the order, so this
+// measures how local the index buffer is, not how many vertices are shaded.
+float computeACMR(std::span<const uint32_t> indices, int cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorders the triangles of an index buffer for vertex locality, using Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation", so that each geometry chunk gathers its corners from
+// a small part of the shaded vertices. Only the order of triangles changes.
+void optimizeVertexCache(std::span<uint32_t> indices, size_t vertexCount);
@@ -0,0 +1,153 @@
+#include "vertexStreams.hpp"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define VERTEX_STREAMS_X86 1
+#include <immintrin.h>
+#endif
+
+// Same as in the rasterizer: each kernel enables the instruction set it is written for
+#if defined(__GNUC__)
+#define VERTEX_STREAMS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define VERTEX_STREAMS_TARGET(isa)
+#endif
+
+void ClipSpaceStreams::resize(size_t count) {
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    w.resize(count);
+}
+
+VertexStreamStorage splitVertexStreams(std::span<const glm::vec3> vertices) {
+    VertexStreamStorage streams;
+    streams.x.reserve(vertices.size());
+    streams.y.reserve(vertices.size());
+    streams.z.reserve(vertices.size());
+    for (const glm::vec3& vertex : vertices) {
+        streams.x.push_back(vertex.x);
+        streams.y.push_back(vertex.y);
+        streams.z.push_back(vertex.z);
+    }
+    return streams;
+}
+
+// glm multiplies a matrix by (x, y, z, 1) as (m[0] * x + m[1] * y) + (m[2] * z + m[3]), and
+// every kernel below evaluates exactly that, one coordinate of 1, 4, 8 or 16 vertices at a time
+static void shadeVertexStreamsScalar(const VertexStreams& input, size_t i, size_t end, const glm::mat4& mvp,
+                                     ClipSpaceStreams& output) {
+    for (; i < end; ++i) {
+        glm::vec4 vertex = (mvp[0] * input.x[i] + mvp[1] * input.y[i]) + (mvp[2] * input.z[i] + mvp[3]);
+        output.x[i] = vertex.x;
+        output.y[i] = vertex.y;
+        output.z[i] = vertex.z;
+        output.w[i] = vertex.w;
+    }
+}
+
+#ifdef VERTEX_STREAMS_X86
+
+VERTEX_STREAMS_TARGET("sse4.1")
+static void shadeVertexStreamsSSE41(const VertexStreams& input, size_t i, size_t end, const glm::mat4& mvp,
+                                    ClipSpaceStreams& output) {
+    float* outputs[4] = {output.x.data(), output.y.data(), output.z.data(), output.w.data()};
+    __m128 m[4][4];
+    for (int column = 0; column < 4; ++column) {
+        for (int row = 0; row < 4; ++row) {
+            m[column][row] = _mm_set1_ps(mvp[column][row]);
+        }
+    }
+
+    for (; i + 4 <= end; i += 4) {
+        __m128 x = _mm_loadu_ps(input.x.data() + i);
+        __m128 y = _mm_loadu_ps(input.y.data() + i);
+        __m128 z = _mm_loadu_ps(input.z.data() + i);
+        for (int row = 0; row < 4; ++row) {
+            __m128 xy = _mm_add_ps(_mm_mul_ps(m[0][row], x), _mm_mul_ps(m[1][row], y));
+            __m128 zw = _mm_add_ps(_mm_mul_ps(m[2][row], z), m[3][row]);
+            _mm_storeu_ps(outputs[row] + i, _mm_add_ps(xy, zw));
+        }
+    }
+    shadeVertexStreamsScalar(input, i, end, mvp, output);
+}
+
+VERTEX_STREAMS_TARGET("avx2")
+static void shadeVertexStreamsAVX2(const VertexStreams& input, size_t i, size_t end, const glm::mat4& mvp,
+                                   ClipSpaceStreams& output) {
+    float* outputs[4] = {output.x.data(), output.y.data(), output.z.data(), output.w.data()};
+    __m256 m[4][4];
+    for (int column = 0; column < 4; ++column) {
+        for (int row = 0; row < 4; ++row) {
+            m[column][row] = _mm256_set1_ps(mvp[column][row]);
+        }
+    }
+
+    for (; i + 8 <= end; i += 8) {
+        __m256 x = _mm256_loadu_ps(input.x.data() + i);
+        __m256 y = _mm256_loadu_ps(input.y.data() + i);
+        __m256 z = _mm256_loadu_ps(input.z.data() + i);
+        for (int row = 0; row < 4; ++row) {
+            __m256 xy = _mm256_add_ps(_mm256_mul_ps(m[0][row], x), _mm256_mul_ps(m[1][row], y));
+            __m256 zw = _mm256_add_ps(_mm256_mul_ps(m[2][row], z), m[3][row]);
+            _mm256_storeu_ps(outputs[row] + i, _mm256_add_ps(xy, zw));
+        }
+    }
+    shadeVertexStreamsScalar(input, i, end, mvp, output);
+}
+
+// The last partial batch is loaded and stored through a lane mask instead of falling back
+VERTEX_STREAMS_TARGET("avx512f")
+static void shadeVertexStreamsAVX512(const VertexStreams& input, size_t i, size_t end, const glm::mat4& mvp,
+                                     ClipSpaceStreams& output) {
+    float* outputs[4] = {output.x.data(), output.y.data(), output.z.data(), output.w.data()};
+    __m512 m[4][4];
+    for (int column = 0; column < 4; ++column) {
+        for (int row = 0; row < 4; ++row) {
+            m[column][row] = _mm512_set1_ps(mvp[column][row]);
+        }
+    }
+
+    for (; i < end; i += 16) {
+        __mmask16 lanes = end - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (end - i)) - 1);
+        __m512 x = _mm512_maskz_loadu_ps(lanes, input.x.data() + i);
+        __m512 y = _mm512_maskz_loadu_ps(lanes, input.y.data() + i);
+        __m512 z = _mm512_maskz_loadu_ps(lanes, input.z.data() + i);
+        for (int row = 0; row < 4; ++row) {
+            __m512 xy = _mm512_add_ps(_mm512_mul_ps(m[0][row], x), _mm512_mul_ps(m[1][row], y));
+            __m512 zw = _mm512_add_ps(_mm512_mul_ps(m[2][row], z), m[3][row]);
+            _mm512_mask_storeu_ps(outputs[row] + i, lanes, _mm512_add_ps(xy, zw));
+        }
+    }
+}
+
+#endif
+
+void shadeVertexStreams(const VertexStreams& input, size_t first, size_t count, const glm::mat4& mvp,
+                        SimdLevel level, ClipSpaceStreams& output) {
+    size_t end = first + count;
+    switch (level) {
+#ifdef VERTEX_STREAMS_X86
+        case SimdLevel::SSE41:
+            shadeVertexStreamsSSE41(input, first, end, mvp, output);
+            return;
+        case SimdLevel::AVX2:
+            shadeVertexStreamsAVX2(input, first, end, mvp, output);
+            return;
+        case SimdLevel::AVX512:
+            shadeVertexStreamsAVX512(input, first, end, mvp, output);
+            return;
+#endif
+        default:
+            shadeVertexStreamsScalar(input, first, end, mvp, output);
+            return;
+    }
+}
+
+std::vector<glm::vec4> gatherVertices(std::span<const uint32_t> indices, const ClipSpaceStreams& vertices) {
+    std::vector<glm::vec4> gathered(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        uint32_t index = indices[i];
+        gathered[i] = glm::vec4(vertices.x[index], vertices.y[index], vertices.z[index], vertices.w[index]);
+    }
+    return gathered;
+}
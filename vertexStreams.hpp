@@ -0,0 +1,57 @@
+#pragma once
+
+#include "shaders.hpp"
+#include <cstddef>
+#include <span>
+#include <vector>
+
+// Arrays of VertexStreams built at run time
+struct VertexStreamStorage {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+};
+
+// Vertex positions stored one array per coordinate (structure of arrays), so the batched vertex
+// stage loads the x, y and z of 4, 8 or 16 consecutive vertices with one instruction each.
+// Non-owning, so the pipeline can draw from a VertexStreamStorage or straight out of a mapped
+// mesh cache. The three arrays have the same size.
+struct VertexStreams {
+    std::span<const float> x;
+    std::span<const float> y;
+    std::span<const float> z;
+
+    VertexStreams() = default;
+    VertexStreams(const VertexStreamStorage& storage) : x(storage.x), y(storage.y), z(storage.z) {}
+    VertexStreams(std::span<const float> x, std::span<const float> y, std::span<const float> z) : x(x), y(y), z(z) {}
+
+    size_t size() const {
+        return x.size();
+    }
+};
+
+// Clip-space positions written by the batched vertex stage, in the same layout
+struct ClipSpaceStreams {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> w;
+
+    void resize(size_t count);
+
+    size_t size() const {
+        return x.size();
+    }
+};
+
+VertexStreamStorage splitVertexStreams(std::span<const glm::vec3> vertices);
+
+// Batched vertex stage: transforms vertices [first, first + count) of input by mvp into the same
+// entries of output, which must already hold input.size() vertices. Disjoint ranges can be shaded
+// concurrently. Each vertex comes out bit for bit as glm computes mvp * glm::vec4(vertex, 1.0f),
+// whatever the level: the kernels round every product and sum in the same order. level must be supported by the CPU.
+void shadeVertexStreams(const VertexStreams& input, size_t first, size_t count, const glm::mat4& mvp,
+                        SimdLevel level, ClipSpaceStreams& output);
+
+// Clip-space corners of every triangle in index order, looked up in the shaded vertices
+std::vector<glm::vec4> gatherVertices(std::span<const uint32_t> indices, const ClipSpaceStreams& vertices);